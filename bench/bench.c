@@ -0,0 +1,167 @@
+/*
+ * Workload driver for the Lispy benchmark suite.
+ *
+ *   bench [-n RUNS] [-l LABEL] LISPY WORKLOAD...
+ *
+ * Runs every workload RUNS times with --no-cache --mem-stats and prints JSON with
+ * the median and p95 wall time, peak RSS and lval allocation count of each one.
+ * Interpreter output is discarded, the counters are read from its stderr.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+
+typedef struct
+{
+  double wall_ms;
+  long max_rss_kb;
+  unsigned long allocs;
+  int status;
+} result;
+
+double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Sum the allocs-* counters printed by --mem-stats */
+unsigned long parse_allocs(FILE *f)
+{
+  unsigned long total = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), f))
+  {
+    char name[64];
+    double value;
+    if (sscanf(line, " %63s %lf", name, &value) == 2 && strncmp(name, "allocs-", 7) == 0)
+    {
+      total += (unsigned long)value;
+    }
+  }
+  return total;
+}
+
+/* Run one workload and measure it */
+result run(char *lispy, char *workload)
+{
+  result r = {0};
+  FILE *err = tmpfile();
+
+  double start = now();
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    dup2(fileno(err), STDERR_FILENO);
+    execl(lispy, lispy, "--no-cache", "--mem-stats", workload, (char *)NULL);
+    _exit(127);
+  }
+
+  struct rusage ru;
+  int status;
+  wait4(pid, &status, 0, &ru);
+  r.wall_ms = (now() - start) * 1000;
+  r.max_rss_kb = ru.ru_maxrss;
+  r.status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+
+  rewind(err);
+  r.allocs = parse_allocs(err);
+  fclose(err);
+  return r;
+}
+
+int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* Workload name from its path without directory or extension */
+void workload_name(char *path, char *name, size_t size)
+{
+  char *base = strrchr(path, '/');
+  base = base ? base + 1 : path;
+  snprintf(name, size, "%s", base);
+  char *dot = strrchr(name, '.');
+  if (dot)
+  {
+    *dot = '\0';
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int runs = 5;
+  char *label = "";
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:l:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      runs = atoi(optarg);
+      break;
+    case 'l':
+      label = optarg;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n RUNS] [-l LABEL] LISPY WORKLOAD...\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (argc - optind < 2 || runs < 1)
+  {
+    fprintf(stderr, "usage: %s [-n RUNS] [-l LABEL] LISPY WORKLOAD...\n", argv[0]);
+    return 1;
+  }
+
+  char *lispy = argv[optind];
+  double *times = malloc(sizeof(double) * runs);
+  int failed = 0;
+
+  printf("{\n  \"label\": \"%s\",\n  \"runs\": %i,\n  \"workloads\": [", label, runs);
+  for (int w = optind + 1; w < argc; w++)
+  {
+    long max_rss_kb = 0;
+    unsigned long allocs = 0;
+    int status = 0;
+
+    for (int i = 0; i < runs; i++)
+    {
+      result r = run(lispy, argv[w]);
+      times[i] = r.wall_ms;
+      max_rss_kb = r.max_rss_kb > max_rss_kb ? r.max_rss_kb : max_rss_kb;
+      allocs = r.allocs;
+      status = r.status ? r.status : status;
+    }
+    qsort(times, runs, sizeof(double), cmp_double);
+
+    /* Nearest rank percentiles */
+    double median = times[(runs - 1) / 2];
+    double p95 = times[(int)(0.95 * runs + 0.999999) - 1];
+
+    char name[256];
+    workload_name(argv[w], name, sizeof(name));
+    printf("%s\n    {\"name\": \"%s\", \"median_ms\": %.3f, \"p95_ms\": %.3f, "
+           "\"max_rss_kb\": %li, \"allocs\": %lu, \"status\": %i}",
+           w > optind + 1 ? "," : "", name, median, p95, max_rss_kb, allocs, status);
+    fflush(stdout);
+    failed |= status != 0;
+  }
+  printf("\n  ]\n}\n");
+
+  free(times);
+  return failed;
+}
@@ -0,0 +1,250 @@
+/*
+ * Client and load generator for `lispy --serve SOCKET`.
+ *
+ *   client SOCKET EXPR...                      evaluate each EXPR and print the result
+ *   client -n N [-c C] [-p P] SOCKET EXPR      send EXPR N times on each of C connections,
+ *                                             keeping P requests in flight per connection
+ *
+ * Frames are a 4 byte big endian length followed by that many bytes.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+typedef struct
+{
+  int fd;
+  int sent;
+  int received;
+
+  /* Partially received response */
+  char *rbuf;
+  size_t rlen;
+  size_t rcap;
+
+  /* Send times of requests in flight, indexed by request number modulo pipeline */
+  double *started;
+} conn;
+
+double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int connect_to(char *path)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    perror("connect");
+    exit(1);
+  }
+  return fd;
+}
+
+/* Build a framed request */
+char *frame(char *expr, size_t *len)
+{
+  size_t n = strlen(expr);
+  char *f = malloc(n + 4);
+  f[0] = n >> 24;
+  f[1] = n >> 16;
+  f[2] = n >> 8;
+  f[3] = n;
+  memcpy(f + 4, expr, n);
+  *len = n + 4;
+  return f;
+}
+
+void write_all(int fd, char *data, size_t len)
+{
+  while (len)
+  {
+    ssize_t n = write(fd, data, len);
+    if (n < 0)
+    {
+      perror("write");
+      exit(1);
+    }
+    data += n;
+    len -= n;
+  }
+}
+
+/* Read into the connection buffer, returns number of complete responses consumed */
+int read_responses(conn *c, int print)
+{
+  if (c->rcap - c->rlen < 65536)
+  {
+    c->rcap = c->rcap * 2 + 65536;
+    c->rbuf = realloc(c->rbuf, c->rcap);
+  }
+  ssize_t n = read(c->fd, c->rbuf + c->rlen, c->rcap - c->rlen);
+  if (n <= 0)
+  {
+    fprintf(stderr, "server closed connection\n");
+    exit(1);
+  }
+  c->rlen += n;
+
+  int done = 0;
+  size_t pos = 0;
+  while (c->rlen - pos >= 4)
+  {
+    unsigned char *h = (unsigned char *)c->rbuf + pos;
+    size_t len = (size_t)h[0] << 24 | h[1] << 16 | h[2] << 8 | h[3];
+    if (c->rlen - pos - 4 < len)
+    {
+      break;
+    }
+    if (print)
+    {
+      printf("%.*s\n", (int)len, c->rbuf + pos + 4);
+    }
+    pos += 4 + len;
+    done++;
+  }
+  memmove(c->rbuf, c->rbuf + pos, c->rlen - pos);
+  c->rlen -= pos;
+  return done;
+}
+
+int main(int argc, char **argv)
+{
+  int requests = 0;
+  int conns = 1;
+  int pipeline = 1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:c:p:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      requests = atoi(optarg);
+      break;
+    case 'c':
+      conns = atoi(optarg);
+      break;
+    case 'p':
+      pipeline = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n requests] [-c connections] [-p pipeline] SOCKET EXPR...\n", argv[0]);
+      return 1;
+    }
+  }
+  if (argc - optind < 2)
+  {
+    fprintf(stderr, "usage: %s [-n requests] [-c connections] [-p pipeline] SOCKET EXPR...\n", argv[0]);
+    return 1;
+  }
+  char *path = argv[optind];
+
+  /* Single shot mode evaluates each expression in turn on one connection */
+  if (requests == 0)
+  {
+    conn c = {connect_to(path), 0, 0, NULL, 0, 0, NULL};
+    for (int i = optind + 1; i < argc; i++)
+    {
+      size_t len;
+      char *f = frame(argv[i], &len);
+      write_all(c.fd, f, len);
+      free(f);
+      while (!read_responses(&c, 1))
+        ;
+    }
+    close(c.fd);
+    free(c.rbuf);
+    return 0;
+  }
+
+  size_t flen;
+  char *f = frame(argv[optind + 1], &flen);
+
+  conn *cs = calloc(conns, sizeof(conn));
+  struct pollfd *pfds = calloc(conns, sizeof(struct pollfd));
+  for (int i = 0; i < conns; i++)
+  {
+    cs[i].fd = connect_to(path);
+    cs[i].started = calloc(pipeline, sizeof(double));
+    pfds[i].fd = cs[i].fd;
+    pfds[i].events = POLLIN;
+  }
+
+  double latency = 0;
+  double start = now();
+  int finished = 0;
+  while (finished < conns)
+  {
+    /* Keep the pipeline of every connection full */
+    for (int i = 0; i < conns; i++)
+    {
+      conn *c = &cs[i];
+      while (c->sent < requests && c->sent - c->received < pipeline)
+      {
+        c->started[c->sent % pipeline] = now();
+        write_all(c->fd, f, flen);
+        c->sent++;
+      }
+    }
+
+    if (poll(pfds, conns, -1) < 0 && errno != EINTR)
+    {
+      perror("poll");
+      return 1;
+    }
+
+    for (int i = 0; i < conns; i++)
+    {
+      if (!(pfds[i].revents & (POLLIN | POLLHUP)))
+      {
+        continue;
+      }
+      conn *c = &cs[i];
+      int got = read_responses(c, 0);
+      double t = now();
+      for (int k = 0; k < got; k++)
+      {
+        latency += t - c->started[(c->received + k) % pipeline];
+      }
+      c->received += got;
+      if (got && c->received == requests)
+      {
+        finished++;
+        pfds[i].fd = -1;
+      }
+    }
+  }
+  double elapsed = now() - start;
+
+  long total = (long)requests * conns;
+  printf("{\"requests\": %ld, \"connections\": %d, \"pipeline\": %d, "
+         "\"seconds\": %.3f, \"requests_per_sec\": %.0f, \"mean_latency_us\": %.1f}\n",
+         total, conns, pipeline, elapsed, total / elapsed, latency / total * 1e6);
+
+  for (int i = 0; i < conns; i++)
+  {
+    close(cs[i].fd);
+    free(cs[i].rbuf);
+    free(cs[i].started);
+  }
+  free(cs);
+  free(pfds);
+  free(f);
+  return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * Number conversion benchmark, numconv against the C library.
+ *
+ *   num_bench [-n COUNT]
+ *
+ * Formats COUNT numbers (10^7 by default) of each shape (integers, short
+ * decimals, arbitrary doubles) into a buffer and reports nanoseconds per
+ * number as JSON for numconv_format, "%.17g" and the old "%f". The formatted
+ * text is then parsed back with numconv_parse, strtod and the old strtof.
+ *
+ *   cc -O2 -I. bench/num_bench.c numconv.c -o num_bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "numconv.h"
+
+double bench_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+uint64_t bench_rand(uint64_t *s)
+{
+  *s ^= *s << 13;
+  *s ^= *s >> 7;
+  *s ^= *s << 17;
+  return *s;
+}
+
+/* Counters and list indices as most Lispy programs print them */
+double gen_integer(uint64_t *s)
+{
+  return (double)(bench_rand(s) % 1000000);
+}
+
+/* Prices and measurements, a few digits after the point */
+double gen_decimal(uint64_t *s)
+{
+  return (double)(bench_rand(s) % 10000000) / 1000;
+}
+
+/* Any finite double, every digit significant */
+double gen_double(uint64_t *s)
+{
+  for (;;)
+  {
+    uint64_t u = bench_rand(s);
+    double x;
+    memcpy(&x, &u, sizeof(x));
+    if (x - x == 0)
+    {
+      return x;
+    }
+  }
+}
+
+typedef struct
+{
+  char *name;
+  double (*gen)(uint64_t *);
+} bench_shape;
+
+bench_shape bench_shapes[] = {
+    {"integer", gen_integer},
+    {"decimal", gen_decimal},
+    {"double", gen_double},
+    {NULL, NULL}};
+
+int main(int argc, char **argv)
+{
+  long count = 10000000;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      count = atol(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n COUNT]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  double *nums = malloc(sizeof(double) * count);
+  char *kinds[] = {"numconv", "printf %.17g", "printf %f"};
+  char *parsers[] = {"numconv", "strtod", "strtof"};
+  size_t total = 0;
+  double sum = 0;
+  int first = 1;
+
+  printf("{\n  \"count\": %li,\n  \"results\": [", count);
+  for (bench_shape *s = bench_shapes; s->name; s++)
+  {
+    uint64_t seed = 88172645463325252ULL;
+    for (long i = 0; i < count; i++)
+    {
+      nums[i] = s->gen(&seed);
+    }
+
+    for (int k = 0; k < 3; k++)
+    {
+      /* Large enough for %f of any double */
+      char buf[512];
+      double start = bench_now();
+      for (long i = 0; i < count; i++)
+      {
+        if (k == 0)
+        {
+          total += numconv_format(nums[i], buf);
+        }
+        else
+        {
+          total += snprintf(buf, sizeof(buf), k == 1 ? "%.17g" : "%f", nums[i]);
+        }
+      }
+      double elapsed = bench_now() - start;
+
+      printf("%s\n    {\"shape\": \"%s\", \"formatter\": \"%s\", \"ns_per_number\": %.1f}",
+             first ? "" : ",", s->name, kinds[k], elapsed / count * 1e9);
+      fflush(stdout);
+      first = 0;
+    }
+
+    /* Shortest round-trip text, newline separated as in a data file */
+    char *text = malloc((size_t)count * NUMCONV_BUFSIZE);
+    char *p = text;
+    for (long i = 0; i < count; i++)
+    {
+      p += numconv_format(nums[i], p);
+      *p++ = '\n';
+    }
+    *p = '\0';
+
+    for (int k = 0; k < 3; k++)
+    {
+      const char *c = text;
+      char *end;
+      double start = bench_now();
+      for (long i = 0; i < count; i++)
+      {
+        double x;
+        if (k == 0)
+        {
+          numconv_parse(c, (const char **)&end, &x);
+        }
+        else
+        {
+          x = k == 1 ? strtod(c, &end) : strtof(c, &end);
+        }
+        sum += x;
+        c = end + 1;
+      }
+      double elapsed = bench_now() - start;
+
+      printf(",\n    {\"shape\": \"%s\", \"parser\": \"%s\", \"ns_per_number\": %.1f}",
+             s->name, parsers[k], elapsed / count * 1e9);
+      fflush(stdout);
+    }
+    free(text);
+  }
+  printf("\n  ],\n  \"chars\": %zu,\n  \"sum\": %g\n}\n", total, sum);
+
+  free(nums);
+  return 0;
+}
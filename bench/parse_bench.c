@@ -0,0 +1,261 @@
+/*
+ * Parser throughput benchmark for mpc and the Lispy grammar.
+ *
+ *   parse_bench [-k KB] [-r RUNS] [-s SHAPE]
+ *
+ * Generates a synthetic corpus of about KB kilobytes for each shape (nested, flat,
+ * comments, strings) and reports MB/s and allocations per KB as JSON for parsing
+ * from a string, a file and a pipe, and for lval_read of the resulting tree.
+ *
+ * Build with malloc wrapped so allocations can be counted:
+ *
+ *   cc -O2 -I. bench/parse_bench.c mpc.c numconv.c -ledit -lm -lpthread \
+ *      -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc -o parse_bench
+ */
+#define LISPY_NO_MAIN
+#include "../strings.c"
+
+#include <sys/wait.h>
+
+unsigned long bench_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+  bench_allocs++;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+  bench_allocs++;
+  return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+  bench_allocs++;
+  return __real_realloc(p, size);
+}
+
+double bench_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Deeply nested expressions, kept shallow enough for the recursive descent parser */
+void gen_nested(lbuf *b)
+{
+  for (int i = 0; i < 100; i++)
+  {
+    lbuf_put(b, "(+ 1 ", 5);
+  }
+  lbuf_put(b, "0", 1);
+  for (int i = 0; i < 100; i++)
+  {
+    lbuf_put(b, ")", 1);
+  }
+  lbuf_put(b, "\n", 1);
+}
+
+/* Long flat lists of numbers and symbols */
+void gen_flat(lbuf *b)
+{
+  char item[32];
+  lbuf_put(b, "{", 1);
+  for (int i = 0; i < 500; i++)
+  {
+    int n = snprintf(item, sizeof(item), i % 2 ? " %i" : " sym%i", i);
+    lbuf_put(b, item, n);
+  }
+  lbuf_put(b, "}\n", 2);
+}
+
+/* Mostly comments with the occasional expression */
+void gen_comments(lbuf *b)
+{
+  char *comment = "; a comment line that the parser has to skip over entirely\n";
+  for (int i = 0; i < 20; i++)
+  {
+    lbuf_put(b, comment, strlen(comment));
+  }
+  lbuf_put(b, "(def {x} 1)\n", 12);
+}
+
+/* Long string literals with escapes */
+void gen_strings(lbuf *b)
+{
+  lbuf_put(b, "(print \"", 8);
+  for (int i = 0; i < 100; i++)
+  {
+    lbuf_put(b, "long string \\\"text\\\" ", 21);
+  }
+  lbuf_put(b, "\\n\")\n", 5);
+}
+
+typedef struct
+{
+  char *name;
+  void (*gen)(lbuf *);
+} bench_shape;
+
+bench_shape bench_shapes[] = {
+    {"nested", gen_nested},
+    {"flat", gen_flat},
+    {"comments", gen_comments},
+    {"strings", gen_strings},
+    {NULL, NULL}};
+
+/* Parse from one of the input kinds, returns the tree or NULL on error */
+mpc_ast_t *bench_parse(linterp *in, char *kind, lbuf *src, char *path)
+{
+  mpc_result_t r;
+  int ok = 0;
+
+  if (strcmp(kind, "string") == 0)
+  {
+    ok = mpc_parse("<bench>", src->data, lispy_parser(in), &r);
+  }
+  else if (strcmp(kind, "file") == 0)
+  {
+    ok = mpc_parse_contents(path, lispy_parser(in), &r);
+  }
+  else
+  {
+    /* A writer thread would be fairer but the pipe buffer is the point being measured */
+    int fds[2];
+    pipe(fds);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      close(fds[0]);
+      size_t off = 0;
+      while (off < src->len)
+      {
+        ssize_t n = write(fds[1], src->data + off, src->len - off);
+        if (n <= 0)
+        {
+          _exit(1);
+        }
+        off += n;
+      }
+      _exit(0);
+    }
+    close(fds[1]);
+    FILE *pipe = fdopen(fds[0], "r");
+    ok = mpc_parse_pipe("<pipe>", pipe, lispy_parser(in), &r);
+    fclose(pipe);
+    waitpid(pid, NULL, 0);
+  }
+
+  if (!ok)
+  {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+    return NULL;
+  }
+  return r.output;
+}
+
+int main(int argc, char **argv)
+{
+  int kb = 1024;
+  int runs = 5;
+  char *only = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "k:r:s:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'k':
+      kb = atoi(optarg);
+      break;
+    case 'r':
+      runs = atoi(optarg);
+      break;
+    case 's':
+      only = optarg;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-k KB] [-r RUNS] [-s SHAPE]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  linterp *in = linterp_new();
+  char *kinds[] = {"string", "file", "pipe", "read"};
+  int first = 1;
+
+  printf("{\n  \"kb\": %i,\n  \"runs\": %i,\n  \"results\": [", kb, runs);
+  for (bench_shape *s = bench_shapes; s->name; s++)
+  {
+    if (only && strcmp(only, s->name) != 0)
+    {
+      continue;
+    }
+
+    /* Repeat the shape until the corpus is big enough */
+    lbuf src = {0};
+    while (src.len < (size_t)kb * 1024)
+    {
+      s->gen(&src);
+    }
+    lbuf_put(&src, "", 1);
+    src.len--;
+
+    char path[] = "/tmp/parse_bench.XXXXXX";
+    int fd = mkstemp(path);
+    write(fd, src.data, src.len);
+    close(fd);
+
+    for (int k = 0; k < 4; k++)
+    {
+      double best = 0;
+      unsigned long allocs = 0;
+
+      for (int i = 0; i < runs; i++)
+      {
+        /* lval_read is timed on its own over a tree parsed from the string */
+        mpc_ast_t *t = k == 3 ? bench_parse(in, "string", &src, path) : NULL;
+
+        unsigned long start_allocs = bench_allocs;
+        double start = bench_now();
+        if (k == 3)
+        {
+          lval_del(lval_read(t));
+        }
+        else
+        {
+          t = bench_parse(in, kinds[k], &src, path);
+        }
+        double elapsed = bench_now() - start;
+        allocs = bench_allocs - start_allocs;
+
+        if (!t)
+        {
+          return 1;
+        }
+        mpc_ast_delete(t);
+        best = i == 0 || elapsed < best ? elapsed : best;
+      }
+
+      printf("%s\n    {\"shape\": \"%s\", \"input\": \"%s\", \"mb_per_sec\": %.2f, \"allocs_per_kb\": %.1f}",
+             first ? "" : ",", s->name, kinds[k], src.len / best / 1e6, allocs / (src.len / 1024.0));
+      fflush(stdout);
+      first = 0;
+    }
+
+    unlink(path);
+    free(src.data);
+  }
+  printf("\n  ]\n}\n");
+
+  linterp_del(in);
+  return 0;
+}
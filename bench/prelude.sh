@@ -0,0 +1,13 @@
+#!/bin/sh
+# Large prelude workload: thousands of definitions, measures parsing and def.
+#
+# usage: bench/prelude.sh > prelude.lspy
+
+echo '(def {fun} (\ {f b} {def (head f) (\ (tail f) b)}))'
+i=0
+while [ $i -lt 3000 ]; do
+  echo "; Definition number $i"
+  echo "(fun {f$i x y} {if (> x y) {+ x $i} {- y \"$i\"}})"
+  echo "(def {v$i} {$i \"value $i\" (f$i 1 2)})"
+  i=$((i + 1))
+done
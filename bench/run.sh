@@ -0,0 +1,30 @@
+#!/bin/sh
+# Benchmark suite: builds the interpreter with optimizations, runs every
+# workload in bench/workloads plus a generated large prelude, and prints
+# JSON with median and p95 wall time, peak RSS and allocation counts.
+#
+# usage: bench/run.sh [runs] > results.json
+#
+# CC, CFLAGS and LIBS can be overridden, e.g. LIBS="-lreadline -lm -lpthread"
+# on systems without libedit.
+
+RUNS=${1:-5}
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:-}
+LIBS=${LIBS:-"-ledit -lm -lpthread"}
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+$CC -O2 $CFLAGS "$ROOT/strings.c" "$ROOT/mpc.c" "$ROOT/numconv.c" $LIBS -o "$TMP/lispy" || exit 1
+$CC -O2 "$ROOT/bench/bench.c" -o "$TMP/bench" || exit 1
+
+# Large prelude: thousands of definitions, measures parsing and def
+sh "$ROOT/bench/prelude.sh" > "$TMP/prelude.lspy"
+
+LABEL=$(git -C "$ROOT" rev-parse --short HEAD 2>/dev/null)
+
+# Workloads run from the temporary directory so nothing is left behind
+cd "$TMP" || exit 1
+./bench -n "$RUNS" -l "$LABEL" ./lispy "$ROOT"/bench/workloads/*.lspy prelude.lspy
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Startup time benchmark: runs an empty script many times and reports
+# the mean wall time per launch, with and without the load cache.
+#
+# usage: bench/startup.sh [path/to/lispy] [runs]
+
+LISPY=${1:-./lispy}
+RUNS=${2:-200}
+
+if [ ! -x "$LISPY" ]; then
+  echo "startup.sh: interpreter '$LISPY' not found" >&2
+  exit 1
+fi
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+: > "$TMP/empty.lspy"
+cd "$TMP" || exit 1
+
+# Time RUNS launches of the interpreter with the given extra arguments
+run() {
+  start=$(date +%s%N)
+  i=0
+  while [ $i -lt "$RUNS" ]; do
+    "$LISPY" "$@" empty.lspy > /dev/null
+    i=$((i + 1))
+  done
+  end=$(date +%s%N)
+  echo $(( (end - start) / RUNS / 1000 ))
+}
+
+# Warm the cache so the cached run never builds the grammar
+"$LISPY" empty.lspy > /dev/null
+
+echo "cached:   $(run) us/launch"
+echo "no-cache: $(run --no-cache) us/launch"
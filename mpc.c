@@ -94,6 +94,9 @@ typedef struct {
   char *lasts;
   char last;
 
+  /* 1 once a DFA parser has run, -1 to run their combinators instead */
+  int dfa;
+
   size_t mem_index;
   char mem_full[MPC_INPUT_MEM_NUM];
   mpc_mem_t mem[MPC_INPUT_MEM_NUM];
@@ -122,6 +125,7 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
+  i->dfa = 0;
 
   i->mem_index = 0;
   memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
@@ -152,6 +156,7 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
   i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
+  i->dfa = 0;
 
   i->mem_index = 0;
   memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
@@ -181,6 +186,7 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
+  i->dfa = 0;
 
   i->mem_index = 0;
   memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
@@ -209,6 +215,7 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
+  i->dfa = 0;
 
   i->mem_index = 0;
   memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
@@ -601,7 +608,7 @@ static void mpc_err_string_cat(char *buffer, int *pos, int *max, char const *fmt
   va_end(va);
 }
 
-static char char_unescape_buffer[4];
+static _Thread_local char char_unescape_buffer[4];
 
 static const char *mpc_err_char_unescape(char c) {
 
@@ -914,7 +921,9 @@ enum {
   MPC_TYPE_CHECK_WITH = 26,
 
   MPC_TYPE_SOI        = 27,
-  MPC_TYPE_EOI        = 28
+  MPC_TYPE_EOI        = 28,
+
+  MPC_TYPE_DFA        = 29
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -935,6 +944,17 @@ typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdat
 typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
 
+/* Transition table for a compiled regex, state 0 is dead and 1 the start */
+typedef struct {
+  int states;
+  int classes;
+  unsigned char classmap[256];
+  unsigned short *table;
+  char *accept;
+} mpc_dfa_t;
+
+typedef struct { mpc_dfa_t *d; mpc_parser_t *x; } mpc_pdata_dfa_t;
+
 typedef union {
   mpc_pdata_fail_t fail;
   mpc_pdata_lift_t lift;
@@ -953,6 +973,7 @@ typedef union {
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
+  mpc_pdata_dfa_t dfa;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
@@ -1032,6 +1053,54 @@ static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x) {
   d(mpc_export(i, x));
 }
 
+static mpc_dfa_t *mpc_dfa_copy(mpc_dfa_t *a) {
+  mpc_dfa_t *d = malloc(sizeof(mpc_dfa_t));
+  memcpy(d, a, sizeof(mpc_dfa_t));
+  d->table = malloc(sizeof(unsigned short) * a->states * a->classes);
+  memcpy(d->table, a->table, sizeof(unsigned short) * a->states * a->classes);
+  d->accept = malloc(a->states);
+  memcpy(d->accept, a->accept, a->states);
+  return d;
+}
+
+static void mpc_dfa_delete(mpc_dfa_t *d) {
+  free(d->table);
+  free(d->accept);
+  free(d);
+}
+
+/* Longest accepted prefix in one pass, no marks and no backtracking */
+static int mpc_input_dfa(mpc_input_t *i, const mpc_dfa_t *d, char **o) {
+
+  const unsigned char *s = (const unsigned char*)i->string + i->state.pos;
+  long j, end = d->accept[1] ? 0 : -1;
+  int k = 1;
+
+  for (j = 0; s[j]; j++) {
+    k = d->table[k * d->classes + d->classmap[s[j]]];
+    if (k == 0) { break; }
+    if (d->accept[k]) { end = j + 1; }
+  }
+
+  if (end < 0) { return 0; }
+
+  for (j = 0; j < end; j++) {
+    i->state.col++;
+    if (s[j] == '\n') {
+      i->state.col = 0;
+      i->state.row++;
+    }
+  }
+
+  if (end > 0) { i->last = (char)s[end-1]; }
+  i->state.pos += end;
+
+  *o = mpc_malloc(i, end + 1);
+  memcpy(*o, s, end);
+  (*o)[end] = '\0';
+  return 1;
+}
+
 enum {
   MPC_PARSE_STACK_MIN = 4
 };
@@ -1071,6 +1140,15 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
     case MPC_TYPE_SOI:     MPC_PRIMITIVE(mpc_input_soi(i, (char**)&r->output));
     case MPC_TYPE_EOI:     MPC_PRIMITIVE(mpc_input_eoi(i, (char**)&r->output));
 
+    /* Compiled regexes, matched on strings and interpreted elsewhere */
+
+    case MPC_TYPE_DFA:
+      if (i->type != MPC_INPUT_STRING || i->dfa < 0) {
+        return mpc_parse_run(i, p->data.dfa.x, r, e, depth+1);
+      }
+      i->dfa = 1;
+      MPC_PRIMITIVE(mpc_input_dfa(i, p->data.dfa.d, (char**)&r->output));
+
     /* Other parsers */
 
     case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i, "Parser Undefined!"));
@@ -1309,6 +1387,15 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
   mpc_err_t *e = mpc_err_fail(i, "Unknown Error");
   e->state = mpc_state_invalid();
   x = mpc_parse_run(i, p, r, &e, 0);
+  if (!x && i->dfa > 0) {
+    /* DFA parsers report no expectations, so failures reparse without them */
+    mpc_err_delete_internal(i, e);
+    mpc_err_delete_internal(i, r->error);
+    i->state = mpc_state_new();
+    i->last = '\0';
+    i->dfa = -1;
+    return mpc_parse_input(i, p, r);
+  }
   if (x) {
     mpc_err_delete_internal(i, e);
     r->output = mpc_export(i, r->output);
@@ -1430,6 +1517,11 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     case MPC_TYPE_OR:  mpc_undefine_or(p);  break;
     case MPC_TYPE_AND: mpc_undefine_and(p); break;
 
+    case MPC_TYPE_DFA:
+      mpc_undefine_unretained(p->data.dfa.x, 0);
+      mpc_dfa_delete(p->data.dfa.d);
+      break;
+
     case MPC_TYPE_CHECK:
       mpc_undefine_unretained(p->data.check.x, 0);
       free(p->data.check.e);
@@ -1564,6 +1656,11 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       strcpy(p->data.check_with.e, a->data.check_with.e);
       break;
 
+    case MPC_TYPE_DFA:
+      p->data.dfa.d = mpc_dfa_copy(a->data.dfa.d);
+      p->data.dfa.x = mpc_copy(a->data.dfa.x);
+      break;
+
     default: break;
   }
 
@@ -2287,20 +2384,14 @@ static const char *mpc_re_range_escape_char(char c) {
   }
 }
 
-static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
+/* Characters of a range expression, complemented by the caller when comp */
+static char *mpc_re_range_chars(const char *s, int comp) {
 
-  mpc_parser_t *out;
   size_t i, j;
   size_t start, end;
   const char *tmp = NULL;
-  const char *s = x;
-  int comp = s[0] == '^' ? 1 : 0;
   char *range = calloc(1,1);
 
-  if (s[0] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); }
-  if (s[0] == '^' &&
-      s[1] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); }
-
   for (i = comp; i < strlen(s); i++){
 
     /* Regex Range Escape */
@@ -2342,6 +2433,21 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
 
   }
 
+  return range;
+}
+
+static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
+
+  mpc_parser_t *out;
+  const char *s = x;
+  int comp = s[0] == '^' ? 1 : 0;
+  char *range;
+
+  if (s[0] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); }
+  if (s[0] == '^' &&
+      s[1] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); }
+
+  range = mpc_re_range_chars(s, comp);
   out = comp == 1 ? mpc_noneof(range) : mpc_oneof(range);
 
   free(x);
@@ -2350,6 +2456,413 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   return out;
 }
 
+/*
+** Regex DFA Compiler
+**
+** Regexes without anchors, lookaheads or counts are also compiled into a
+** transition table over the Glushkov positions of the regex, one per
+** character set. The combinators are greedy and never backtrack into a
+** repetition or a choice once it has matched, so a table is only built
+** when it picks the same match: where several positions accept the same
+** character the first one must be a lone character set whose construct
+** (a repetition, an option or a branch) is complete once it matches.
+** Anything else keeps to the combinators alone.
+*/
+
+enum {
+  MPC_DFA_POSITIONS_MAX = 1024
+};
+
+/* Positions in priority order, atomic if the construct completes on it */
+typedef struct {
+  int n;
+  int *pos;
+  char *atomic;
+} mpc_dfa_list_t;
+
+typedef struct {
+  mpc_dfa_list_t first;
+  mpc_dfa_list_t last;
+  int nullable;
+  int leaf;
+  int simple;
+} mpc_dfa_frag_t;
+
+typedef struct {
+  const char *s;
+  int mode;
+  int failed;
+  int num;
+  unsigned char sets[MPC_DFA_POSITIONS_MAX][32];
+  mpc_dfa_list_t follow[MPC_DFA_POSITIONS_MAX];
+} mpc_dfa_build_t;
+
+static void mpc_dfa_list_push(mpc_dfa_list_t *l, int pos, int atomic) {
+  l->n++;
+  l->pos = realloc(l->pos, sizeof(int) * l->n);
+  l->atomic = realloc(l->atomic, l->n);
+  l->pos[l->n-1] = pos;
+  l->atomic[l->n-1] = atomic;
+}
+
+static void mpc_dfa_list_append(mpc_dfa_list_t *l, mpc_dfa_list_t *x, int atomic) {
+  int j;
+  for (j = 0; j < x->n; j++) {
+    mpc_dfa_list_push(l, x->pos[j], atomic && x->atomic[j]);
+  }
+}
+
+static void mpc_dfa_list_free(mpc_dfa_list_t *l) {
+  free(l->pos);
+  free(l->atomic);
+  l->n = 0;
+  l->pos = NULL;
+  l->atomic = NULL;
+}
+
+static mpc_dfa_frag_t mpc_dfa_empty(void) {
+  mpc_dfa_frag_t f;
+  memset(&f, 0, sizeof(f));
+  f.nullable = 1;
+  f.leaf = -1;
+  return f;
+}
+
+static void mpc_dfa_frag_free(mpc_dfa_frag_t *f) {
+  mpc_dfa_list_free(&f->first);
+  mpc_dfa_list_free(&f->last);
+}
+
+static mpc_dfa_frag_t mpc_dfa_fail(mpc_dfa_build_t *b) {
+  b->failed = 1;
+  return mpc_dfa_empty();
+}
+
+static mpc_dfa_frag_t mpc_dfa_leaf(mpc_dfa_build_t *b, const char *chars, int comp) {
+
+  int c;
+  mpc_dfa_frag_t f;
+
+  if (b->num == MPC_DFA_POSITIONS_MAX) { return mpc_dfa_fail(b); }
+
+  memset(b->sets[b->num], 0, 32);
+  for (c = 1; c < 256; c++) {
+    if ((strchr(chars, (char)c) != NULL) != comp) {
+      b->sets[b->num][c / 8] |= 1 << (c % 8);
+    }
+  }
+
+  f = mpc_dfa_empty();
+  f.nullable = 0;
+  f.leaf = b->num;
+  f.simple = 1;
+  mpc_dfa_list_push(&f.first, b->num, 1);
+  mpc_dfa_list_push(&f.last, b->num, 1);
+  b->num++;
+  return f;
+}
+
+static mpc_dfa_frag_t mpc_dfa_char(mpc_dfa_build_t *b, char c) {
+  char chars[2];
+  chars[0] = c;
+  chars[1] = '\0';
+  return mpc_dfa_leaf(b, chars, 0);
+}
+
+static mpc_dfa_frag_t mpc_dfa_concat(mpc_dfa_build_t *b, mpc_dfa_frag_t x, mpc_dfa_frag_t y) {
+
+  int j;
+  mpc_dfa_frag_t f = mpc_dfa_empty();
+
+  for (j = 0; j < x.last.n; j++) {
+    mpc_dfa_list_append(&b->follow[x.last.pos[j]], &y.first, 1);
+  }
+
+  mpc_dfa_list_append(&f.first, &x.first, 1);
+  if (x.nullable) { mpc_dfa_list_append(&f.first, &y.first, 1); }
+
+  mpc_dfa_list_append(&f.last, &y.last, 1);
+  if (y.nullable) { mpc_dfa_list_append(&f.last, &x.last, 1); }
+
+  f.nullable = x.nullable && y.nullable;
+
+  mpc_dfa_frag_free(&x);
+  mpc_dfa_frag_free(&y);
+  return f;
+}
+
+static mpc_dfa_frag_t mpc_dfa_alt(mpc_dfa_build_t *b, mpc_dfa_frag_t x, mpc_dfa_frag_t y) {
+
+  int j;
+  mpc_dfa_frag_t f;
+
+  /* An empty match commits, so later branches would never be tried */
+  if (x.nullable) {
+    mpc_dfa_frag_free(&x);
+    mpc_dfa_frag_free(&y);
+    return mpc_dfa_fail(b);
+  }
+
+  /* Branches of one character each are one set */
+  if (x.leaf >= 0 && y.leaf >= 0) {
+    for (j = 0; j < 32; j++) { b->sets[x.leaf][j] |= b->sets[y.leaf][j]; }
+    if (y.leaf == b->num-1) { b->num--; }
+    mpc_dfa_frag_free(&y);
+    return x;
+  }
+
+  f = mpc_dfa_empty();
+  f.nullable = y.nullable;
+  mpc_dfa_list_append(&f.first, &x.first, x.simple);
+  mpc_dfa_list_append(&f.first, &y.first, y.simple);
+  mpc_dfa_list_append(&f.last, &x.last, 1);
+  mpc_dfa_list_append(&f.last, &y.last, 1);
+
+  mpc_dfa_frag_free(&x);
+  mpc_dfa_frag_free(&y);
+  return f;
+}
+
+static mpc_dfa_frag_t mpc_dfa_repeat(mpc_dfa_build_t *b, mpc_dfa_frag_t x, char op) {
+
+  int j;
+  int leaf = x.leaf >= 0;
+  mpc_dfa_frag_t f;
+
+  /* Bodies that can match nothing make the combinators stop early */
+  if (x.nullable) {
+    mpc_dfa_frag_free(&x);
+    return mpc_dfa_fail(b);
+  }
+
+  if (op != '?') {
+    for (j = 0; j < x.last.n; j++) {
+      mpc_dfa_list_append(&b->follow[x.last.pos[j]], &x.first, leaf);
+    }
+  }
+
+  f = mpc_dfa_empty();
+  f.nullable = op != '+';
+  f.simple = leaf;
+  mpc_dfa_list_append(&f.first, &x.first, leaf);
+  mpc_dfa_list_append(&f.last, &x.last, 1);
+
+  mpc_dfa_frag_free(&x);
+  return f;
+}
+
+static mpc_dfa_frag_t mpc_dfa_regex(mpc_dfa_build_t *b);
+
+static mpc_dfa_frag_t mpc_dfa_range(mpc_dfa_build_t *b) {
+
+  const char *start = b->s;
+  char *s, *range;
+  int comp;
+  mpc_dfa_frag_t f;
+
+  while (*b->s != '\0' && *b->s != ']') {
+    if (*b->s == '\\') {
+      if (b->s[1] == '\0') { return mpc_dfa_fail(b); }
+      b->s++;
+    }
+    b->s++;
+  }
+
+  if (*b->s != ']' || b->s == start) { return mpc_dfa_fail(b); }
+
+  s = calloc(1, b->s - start + 1);
+  memcpy(s, start, b->s - start);
+  b->s++;
+
+  comp = s[0] == '^' ? 1 : 0;
+  if (comp && s[1] == '\0') {
+    free(s);
+    return mpc_dfa_fail(b);
+  }
+
+  range = mpc_re_range_chars(s, comp);
+  f = mpc_dfa_leaf(b, range, comp);
+  free(range);
+  free(s);
+  return f;
+}
+
+static mpc_dfa_frag_t mpc_dfa_escape(mpc_dfa_build_t *b, char c) {
+  switch (c) {
+    case 'a': return mpc_dfa_char(b, '\a');
+    case 'f': return mpc_dfa_char(b, '\f');
+    case 'n': return mpc_dfa_char(b, '\n');
+    case 'r': return mpc_dfa_char(b, '\r');
+    case 't': return mpc_dfa_char(b, '\t');
+    case 'v': return mpc_dfa_char(b, '\v');
+    case 'd': return mpc_dfa_leaf(b, "0123456789", 0);
+    case 's': return mpc_dfa_leaf(b, " \f\n\r\t\v", 0);
+    case 'w': return mpc_dfa_leaf(b, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_", 0);
+    case 'b': case 'B': case 'A': case 'Z':
+    case 'D': case 'S': case 'W': case '\0':
+      return mpc_dfa_fail(b);
+    default: return mpc_dfa_char(b, c);
+  }
+}
+
+static mpc_dfa_frag_t mpc_dfa_base(mpc_dfa_build_t *b) {
+
+  char c = *b->s++;
+  mpc_dfa_frag_t f;
+
+  switch (c) {
+    case '(':
+      f = mpc_dfa_regex(b);
+      if (*b->s != ')') { mpc_dfa_frag_free(&f); return mpc_dfa_fail(b); }
+      b->s++;
+      return f;
+    case '[': return mpc_dfa_range(b);
+    case '\\': c = *b->s; if (c != '\0') { b->s++; } return mpc_dfa_escape(b, c);
+    case '.': return (b->mode & MPC_RE_DOTALL) ? mpc_dfa_leaf(b, "", 1) : mpc_dfa_leaf(b, "\n", 1);
+    /* Anchors, and stray operators the combinators read literally */
+    case '^': case '$': case '*': case '+': case '?': case '{':
+      return mpc_dfa_fail(b);
+    default: return mpc_dfa_char(b, c);
+  }
+}
+
+static mpc_dfa_frag_t mpc_dfa_factor(mpc_dfa_build_t *b) {
+
+  mpc_dfa_frag_t f = mpc_dfa_base(b);
+
+  if (b->failed) { return f; }
+
+  switch (*b->s) {
+    case '*': case '+': case '?':
+      return mpc_dfa_repeat(b, f, *b->s++);
+    /* A count that fails part way does not rewind what it consumed */
+    case '{':
+      mpc_dfa_frag_free(&f);
+      return mpc_dfa_fail(b);
+    default:
+      return f;
+  }
+}
+
+static mpc_dfa_frag_t mpc_dfa_term(mpc_dfa_build_t *b) {
+
+  mpc_dfa_frag_t f = mpc_dfa_empty();
+  int first = 1;
+
+  while (!b->failed && *b->s != '\0' && *b->s != '|' && *b->s != ')') {
+    if (first) {
+      mpc_dfa_frag_free(&f);
+      f = mpc_dfa_factor(b);
+      first = 0;
+    } else {
+      f = mpc_dfa_concat(b, f, mpc_dfa_factor(b));
+    }
+  }
+
+  return f;
+}
+
+static mpc_dfa_frag_t mpc_dfa_regex(mpc_dfa_build_t *b) {
+  mpc_dfa_frag_t f = mpc_dfa_term(b);
+  if (b->failed || *b->s != '|') { return f; }
+  b->s++;
+  return mpc_dfa_alt(b, f, mpc_dfa_regex(b));
+}
+
+static int mpc_dfa_member(mpc_dfa_build_t *b, int pos, int c) {
+  return (b->sets[pos][c / 8] >> (c % 8)) & 1;
+}
+
+/* Bytes are grouped into classes that every position treats the same */
+static void mpc_dfa_classes(mpc_dfa_build_t *b, mpc_dfa_t *d) {
+
+  int p, c, k, n;
+  int split[256][2];
+
+  memset(d->classmap, 0, 256);
+  d->classes = 1;
+
+  for (p = 0; p < b->num; p++) {
+    for (k = 0; k < d->classes; k++) { split[k][0] = split[k][1] = -1; }
+    n = 0;
+    for (c = 0; c < 256; c++) {
+      k = d->classmap[c];
+      if (split[k][mpc_dfa_member(b, p, c)] < 0) {
+        split[k][mpc_dfa_member(b, p, c)] = n++;
+      }
+      d->classmap[c] = split[k][mpc_dfa_member(b, p, c)];
+    }
+    d->classes = n;
+  }
+}
+
+static mpc_dfa_t *mpc_dfa_compile(const char *re, int mode) {
+
+  int s, k, c, j, win;
+  mpc_dfa_list_t *l;
+  mpc_dfa_t *d = NULL;
+  mpc_dfa_build_t *b = calloc(1, sizeof(mpc_dfa_build_t));
+  mpc_dfa_frag_t f;
+  int rep[256];
+
+  b->s = re;
+  b->mode = mode;
+  f = mpc_dfa_regex(b);
+  if (b->failed || *b->s != '\0') { goto done; }
+
+  d = calloc(1, sizeof(mpc_dfa_t));
+  mpc_dfa_classes(b, d);
+  for (c = 255; c >= 0; c--) { rep[d->classmap[c]] = c; }
+
+  d->states = b->num + 2;
+  d->table = calloc(d->states * d->classes, sizeof(unsigned short));
+  d->accept = calloc(d->states, 1);
+
+  d->accept[1] = f.nullable;
+  for (j = 0; j < f.last.n; j++) { d->accept[f.last.pos[j] + 2] = 1; }
+
+  for (s = 1; s < d->states; s++) {
+    l = s == 1 ? &f.first : &b->follow[s-2];
+    for (k = 0; k < d->classes; k++) {
+      win = -1;
+      for (j = 0; j < l->n; j++) {
+        if (!mpc_dfa_member(b, l->pos[j], rep[k])) { continue; }
+        if (win < 0) { win = j; continue; }
+        if (l->pos[j] != l->pos[win] && !l->atomic[win]) {
+          mpc_dfa_delete(d);
+          d = NULL;
+          goto done;
+        }
+      }
+      if (win >= 0) { d->table[s * d->classes + k] = l->pos[win] + 2; }
+    }
+  }
+
+done:
+  mpc_dfa_frag_free(&f);
+  for (j = 0; j < MPC_DFA_POSITIONS_MAX; j++) { mpc_dfa_list_free(&b->follow[j]); }
+  free(b);
+  return d;
+}
+
+/* Fronts the combinators with a table when the regex compiles to one */
+static mpc_parser_t *mpc_re_dfa(const char *re, int mode, mpc_parser_t *x) {
+
+  mpc_parser_t *p;
+  mpc_dfa_t *d;
+
+  if (x->type == MPC_TYPE_FAIL) { return x; }
+
+  d = mpc_dfa_compile(re, mode);
+  if (d == NULL) { return x; }
+
+  p = mpc_undefined();
+  p->type = MPC_TYPE_DFA;
+  p->data.dfa.d = d;
+  p->data.dfa.x = x;
+  return p;
+}
+
 mpc_parser_t *mpc_re(const char *re) {
   return mpc_re_mode(re, MPC_RE_DEFAULT);
 }
@@ -2417,7 +2930,7 @@ mpc_parser_t *mpc_re_mode(const char *re, int mode) {
 
   mpc_optimise(r.output);
 
-  return r.output;
+  return mpc_re_dfa(re, mode, r.output);
 
 }
 
@@ -2769,6 +3282,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_DFA)      { mpc_print_unretained(p->data.dfa.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { mpc_print_unretained(p->data.not.x, 0); printf("!"); }
   if (p->type == MPC_TYPE_MAYBE) { mpc_print_unretained(p->data.not.x, 0); printf("?"); }
@@ -3866,6 +4380,8 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
   if (p->type == MPC_TYPE_MANY1) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
   if (p->type == MPC_TYPE_COUNT) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
 
+  if (p->type == MPC_TYPE_DFA)   { return 1 + mpc_nodecount_unretained(p->data.dfa.x, 0); }
+
   if (p->type == MPC_TYPE_OR) {
     total = 1;
     for(i = 0; i < p->data.or.n; i++) {
@@ -3912,6 +4428,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_MANY)       { mpc_optimise_unretained(p->data.repeat.x, 0); }
   if (p->type == MPC_TYPE_MANY1)      { mpc_optimise_unretained(p->data.repeat.x, 0); }
   if (p->type == MPC_TYPE_COUNT)      { mpc_optimise_unretained(p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_DFA)        { mpc_optimise_unretained(p->data.dfa.x, 0); }
 
   if (p->type == MPC_TYPE_OR) {
     for(i = 0; i < p->data.or.n; i++) {
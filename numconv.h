@@ -0,0 +1,24 @@
+/*
+** numconv - number formatting for Lispy
+**
+** numconv_format writes the shortest decimal string that reads back as the
+** same double, using Grisu2 with a fast path for integers. numconv_parse reads
+** a decimal number correctly rounded, using Eisel-Lemire with a fast path for
+** integers and short decimals.
+*/
+
+#ifndef numconv_h
+#define numconv_h
+
+/* Longest output of numconv_format including the terminator */
+#define NUMCONV_BUFSIZE 32
+
+/* Format x into buf, which must hold NUMCONV_BUFSIZE bytes, returns the length */
+int numconv_format(double x, char *buf);
+
+/* Parse the number at the start of s into x, setting end past it.
+ * Returns 1 on success, 0 if s does not start with a number and -1 if it is
+ * too large for a double, in which case x is set to an infinity. */
+int numconv_parse(const char *s, const char **end, double *x);
+
+#endif
@@ -1,7 +1,24 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <time.h>
+#include <setjmp.h>
 #include "mpc.h"
+#include "numconv.h"
 
 #ifdef _WIN32
 #include <string.h>
@@ -31,7 +48,7 @@ void add_history(char *unused) {}
   {                                           \
     lval *err = lval_err(fmt, ##__VA_ARGS__); \
     lval_del(args);                           \
-    return err;                               \
+    return lval_raise(err);                   \
   }
 
 #define LASSERT_TYPE(args, func, index, required)                                      \
@@ -46,22 +63,30 @@ void add_history(char *unused) {}
 
 #define LASSERT_EMPTY(args, func, index)       \
   LASSERT(args, args->cell[index]->count != 0, \
-          "Function '%s' passed {}!");
-
-/* Parsers forward declarations */
-mpc_parser_t *Number;
-mpc_parser_t *Symbol;
-mpc_parser_t *String;
-mpc_parser_t *Comment;
-mpc_parser_t *Sexpr;
-mpc_parser_t *Qexpr;
-mpc_parser_t *Expr;
-mpc_parser_t *Lispy;
+          "Function '%s' passed {}!", func);
 
 struct lval;
 struct lenv;
+struct linterp;
+struct lchan;
+struct lsched;
+struct lprof;
+struct lsampler;
+struct lmemo;
+struct lmap;
+struct lsymcache;
+struct lerr;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct linterp linterp;
+typedef struct lchan lchan;
+typedef struct lsched lsched;
+typedef struct lprof lprof;
+typedef struct lsampler lsampler;
+typedef struct lmemo lmemo;
+typedef struct lmap lmap;
+typedef struct lsymcache lsymcache;
+typedef struct lerr lerr;
 
 /* Create Enumeration of Possible lval Types */
 enum
@@ -72,7 +97,10 @@ enum
   LVAL_STR,
   LVAL_FUN,
   LVAL_SEXPR,
-  LVAL_QEXPR
+  LVAL_QEXPR,
+  LVAL_CHAN,
+  LVAL_MAP,
+  LVAL_TYPES
 };
 
 typedef lval *(*lbuiltin)(lenv *, lval *);
@@ -84,19 +112,38 @@ struct lval
 
   /* Basic */
   double num;
-  char *err;
+  lerr *err;
   char *sym;
   char *str;
 
+  /* Global lookup cache of a symbol, shared between copies */
+  lsymcache *cache;
+
   /* Function */
   lbuiltin builtin;
   lenv *env;
   lval *formals;
   lval *body;
 
+  /* Result cache of a memoized lambda, shared between copies */
+  lmemo *memo;
+
+  /* Body with constant calls to pure builtins folded, NULL if nothing folded */
+  lval *folded;
+
   /* Expression */
   int count;
   lval **cell;
+
+  /* Structural hash of a Q-expression, valid while hashed is set */
+  uint64_t hash;
+  int hashed;
+
+  /* Channel, shared between copies */
+  lchan *chan;
+
+  /* Hash map, copied like lists */
+  lmap *map;
 };
 
 /* Declare New lenv Struct */
@@ -106,36 +153,334 @@ struct lenv
   int count;
   char **syms;
   lval **vals;
+
+  /* Falls back to the static builtin table when set, such environments are roots */
+  int builtins;
+
+  /* Bindings of a root shared read only with other threads, searched after its own */
+  lenv *base;
+
+  /* Unique among all environments, renewed when a root gains a binding */
+  unsigned long version;
+
+  /* Interpreter this environment is evaluated in */
+  linterp *interp;
+
+  /* Interpreter its bindings are counted in, NULL while nothing evaluates in it */
+  linterp *counted;
+};
+
+/* Name hash slots for counting local bindings */
+#define LSYM_LOCAL_SLOTS 4096
+
+/* Declare New Interpreter Struct */
+/* Holds all state of one interpreter so several can run on separate threads */
+struct linterp
+{
+  /* Parsers, built on first use */
+  mpc_parser_t *Number;
+  mpc_parser_t *Symbol;
+  mpc_parser_t *String;
+  mpc_parser_t *Comment;
+  mpc_parser_t *Sexpr;
+  mpc_parser_t *Qexpr;
+  mpc_parser_t *Expr;
+  mpc_parser_t *Lispy;
+
+  /* Global environment */
+  lenv *env;
+
+  /* Bindings per name hash in environments in use outside of the global one */
+  long locals[LSYM_LOCAL_SLOTS];
+
+  /* Bindings in use that shadow a foldable builtin */
+  long fold_shadows;
+
+  /* Stream that printing goes to */
+  FILE *out;
+
+  /* Compiled file cache settings */
+  int cache;
+  char *cache_dir;
+
+  /* Green thread scheduler, created by the first spawn */
+  lsched *sched;
+
+  /* Call profiler, NULL unless profiling */
+  lprof *prof;
+
+  /* Sampling profiler, NULL unless sampling */
+  lsampler *sampler;
+};
+
+/* Grammar text, also hashed into load cache headers */
+const char lispy_grammar[] =
+    "                                                         \
+      number : /-?[0-9]+[.]*[0-9]*([eE][-+]?[0-9]+)?/ ;              \
+      symbol : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;                     \
+      string : /\"([^\"\\\\]|\\\\(.|\\n)?)*\"/ ;                      \
+      comment: /;[^\\r\\n]*/ ;                                        \
+      sexpr  : '(' <expr>* ')' ;                                      \
+      qexpr  : '{' <expr>* '}' ;                                      \
+      expr   : <number> | <symbol> | <string>                         \
+             | <comment> | <sexpr> | <qexpr> ;                        \
+      lispy  : /^/ <expr>* /$/ ;                                      \
+      ";
+
+/* Build the grammar on first use so scripts that never parse pay nothing */
+mpc_parser_t *lispy_parser(linterp *in)
+{
+  if (in->Lispy)
+  {
+    return in->Lispy;
+  }
+
+  /* Create Parsers */
+  in->Number = mpc_new("number");
+  in->Symbol = mpc_new("symbol");
+  in->String = mpc_new("string");
+  in->Comment = mpc_new("comment");
+  in->Sexpr = mpc_new("sexpr");
+  in->Qexpr = mpc_new("qexpr");
+  in->Expr = mpc_new("expr");
+  in->Lispy = mpc_new("lispy");
+
+  /* Define them with the following Language */
+  mpca_lang(MPCA_LANG_DEFAULT, lispy_grammar,
+            in->Number, in->Symbol, in->String, in->Comment,
+            in->Sexpr, in->Qexpr, in->Expr, in->Lispy);
+
+  return in->Lispy;
+}
+
+
+/* Number of lvals allocated by this thread */
+_Thread_local unsigned long lval_allocs;
+
+/* Allocation and lifetime counters, kept per thread and merged when threads exit */
+typedef struct
+{
+  unsigned long allocs[LVAL_TYPES];
+  unsigned long frees;
+  unsigned long bytes;
+  long live;
+  long peak;
+
+  /* Deep copies, and the share of them made by variable lookups */
+  unsigned long copies;
+  unsigned long copy_bytes;
+  unsigned long get_copies;
+
+  unsigned long env_news;
+  unsigned long env_copies;
+  unsigned long env_puts;
+  long env_live;
+  long env_peak;
+} lmem_stats;
+
+_Thread_local lmem_stats lmem;
+
+/* Totals from threads that have finished */
+lmem_stats lmem_merged;
+pthread_mutex_t lmem_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void lmem_add(lmem_stats *to, lmem_stats *from)
+{
+  for (int i = 0; i < LVAL_TYPES; i++)
+  {
+    to->allocs[i] += from->allocs[i];
+  }
+  to->frees += from->frees;
+  to->bytes += from->bytes;
+  to->live += from->live;
+  to->peak = to->peak > from->peak ? to->peak : from->peak;
+  to->copies += from->copies;
+  to->copy_bytes += from->copy_bytes;
+  to->get_copies += from->get_copies;
+  to->env_news += from->env_news;
+  to->env_copies += from->env_copies;
+  to->env_puts += from->env_puts;
+  to->env_live += from->env_live;
+  to->env_peak = to->env_peak > from->env_peak ? to->env_peak : from->env_peak;
+}
+
+/* Fold this thread's counters into the process totals */
+void lmem_merge(void)
+{
+  pthread_mutex_lock(&lmem_lock);
+  lmem_add(&lmem_merged, &lmem);
+  pthread_mutex_unlock(&lmem_lock);
+  memset(&lmem, 0, sizeof(lmem));
+}
+
+/* Counters of this thread plus all finished threads */
+lmem_stats lmem_total(void)
+{
+  lmem_stats t = lmem;
+  pthread_mutex_lock(&lmem_lock);
+  lmem_add(&t, &lmem_merged);
+  pthread_mutex_unlock(&lmem_lock);
+  return t;
+}
+
+lval *lval_alloc(int type)
+{
+  lval_allocs++;
+  lmem.allocs[type]++;
+  lmem.bytes += sizeof(lval);
+  if (++lmem.live > lmem.peak)
+  {
+    lmem.peak = lmem.live;
+  }
+  lval *v = malloc(sizeof(lval));
+  v->type = type;
+  v->hashed = 0;
+  return v;
+}
+
+/* Inline caches for global lookups */
+
+/* A cache stamp is a root version with a slot in the low bits */
+#define LSYM_SLOT_BITS 20
+#define LSYM_SLOT_MASK ((1UL << LSYM_SLOT_BITS) - 1)
+#define LSYM_BUILTIN (1UL << (LSYM_SLOT_BITS - 1))
+#define LSYM_BASE (1UL << (LSYM_SLOT_BITS - 2))
+
+unsigned long lenv_versions;
+
+unsigned long lenv_next_version(void)
+{
+  return __atomic_add_fetch(&lenv_versions, 1, __ATOMIC_RELAXED);
+}
+
+/* Written and read as one word so copies on other threads never see half an update */
+struct lsymcache
+{
+  int refs;
+  uint64_t hash;
+  uint64_t stamp;
 };
 
+uint64_t lcache_hash(const char *data, size_t len);
+
+lsymcache *lsymcache_new(char *name)
+{
+  lsymcache *c = malloc(sizeof(lsymcache));
+  c->refs = 1;
+  c->hash = lcache_hash(name, strlen(name));
+  c->stamp = 0;
+  return c;
+}
+
+void lsymcache_release(lsymcache *c)
+{
+  if (__atomic_sub_fetch(&c->refs, 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    free(c);
+  }
+}
+
+/* Track bindings in non-root environments, a name with none always resolves at the root */
+void lsym_local(lenv *e, char *name, int delta)
+{
+  if (e->counted && !e->builtins)
+  {
+    uint64_t h = lcache_hash(name, strlen(name));
+    e->counted->locals[h % LSYM_LOCAL_SLOTS] += delta;
+  }
+}
+
 /* Create lenv structure */
 lenv *lenv_new(void)
 {
+  lmem.env_news++;
+  if (++lmem.env_live > lmem.env_peak)
+  {
+    lmem.env_peak = lmem.env_live;
+  }
+
   lenv *e = malloc(sizeof(lenv));
   e->par = NULL;
   e->count = 0;
   e->syms = NULL;
   e->vals = NULL;
+  e->builtins = 0;
+  e->base = NULL;
+  e->interp = NULL;
+  e->counted = NULL;
+  e->version = lenv_next_version();
   return e;
 }
 
 /* Construct string lval */
 lval *lval_str(char *s)
 {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_STR;
+  lval *v = lval_alloc(LVAL_STR);
   v->str = malloc(strlen(s) + 1);
   strcpy(v->str, s);
+  lmem.bytes += strlen(s) + 1;
   return v;
 }
 
 void lval_del(lval *v);
 
+/* Builtins that constant folding may evaluate ahead of time */
+static char *lfold_builtins[] = {"+", "-", "*", "/", "==", "!=", ">", "<", ">=", "<=",
+                                 "head", "tail", NULL};
+
+int lfold_pure(char *name)
+{
+  /* Cheap rejection since this runs on every binding */
+  if (!strchr("+-*/=!<>ht", name[0]))
+  {
+    return 0;
+  }
+  for (char **b = lfold_builtins; *b; b++)
+  {
+    if (strcmp(*b, name) == 0)
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Track bindings that shadow a foldable builtin, folded bodies are only used while there are none */
+void lfold_shadow(lenv *e, char *name, int delta)
+{
+  if (e->counted && lfold_pure(name))
+  {
+    e->counted->fold_shadows += delta;
+  }
+}
+
+/* Move the counts of e's bindings to the interpreter now using it, or drop them with NULL */
+void lenv_count(lenv *e, linterp *in)
+{
+  if (e->counted == in)
+  {
+    return;
+  }
+  for (int i = 0; i < e->count; i++)
+  {
+    lfold_shadow(e, e->syms[i], -1);
+    lsym_local(e, e->syms[i], -1);
+  }
+  e->counted = in;
+  for (int i = 0; i < e->count; i++)
+  {
+    lfold_shadow(e, e->syms[i], 1);
+    lsym_local(e, e->syms[i], 1);
+  }
+}
+
 /* Delete lenv structure */
 void lenv_del(lenv *e)
 {
   for (int i = 0; i < e->count; i++)
   {
+    lfold_shadow(e, e->syms[i], -1);
+    lsym_local(e, e->syms[i], -1);
     free(e->syms[i]);
     lval_del(e->vals[i]);
   }
@@ -143,38 +488,126 @@ void lenv_del(lenv *e)
   free(e->syms);
   free(e->vals);
   free(e);
+  lmem.env_live--;
 }
 
 lval *lval_err(char *fmt, ...);
 
 lval *lval_copy(lval *v);
+lval *lval_builtin(lbuiltin func);
+lbuiltin lbuiltin_lookup(char *name);
+int lbuiltin_index(char *name);
+lbuiltin lbuiltin_func(int i);
+
+lval *lenv_get_copy(lval *x)
+{
+  unsigned long before = lmem.copies;
+  lval *v = lval_copy(x);
+  lmem.get_copies += lmem.copies - before;
+  return v;
+}
+
+/* Resolve through the symbol's inline cache, NULL on a miss */
+lval *lenv_get_cached(lenv *root, lsymcache *c)
+{
+  uint64_t stamp = __atomic_load_n(&c->stamp, __ATOMIC_RELAXED);
+  if (stamp >> LSYM_SLOT_BITS != root->version)
+  {
+    return NULL;
+  }
+
+  uint64_t slot = stamp & LSYM_SLOT_MASK;
+  if (slot & LSYM_BUILTIN)
+  {
+    return lval_builtin(lbuiltin_func(slot & ~LSYM_BUILTIN));
+  }
+  if (slot & LSYM_BASE)
+  {
+    return lenv_get_copy(root->base->vals[slot & ~LSYM_BASE]);
+  }
+  return lenv_get_copy(root->vals[slot]);
+}
+
+void lenv_cache_fill(lsymcache *c, lenv *root, uint64_t slot)
+{
+  __atomic_store_n(&c->stamp, (uint64_t)root->version << LSYM_SLOT_BITS | slot, __ATOMIC_RELAXED);
+}
 
 lval *lenv_get(lenv *e, lval *k)
 {
-  for (int i = 0; i < e->count; i++)
+  /* Names nobody binds locally resolve at the root, so the cache can skip the frames */
+  lenv *root = e->interp ? e->interp->env : NULL;
+  lsymcache *c = k->cache;
+  int cacheable = c && root && !e->interp->locals[c->hash % LSYM_LOCAL_SLOTS];
+  if (cacheable)
   {
-    if (strcmp(e->syms[i], k->sym) == 0)
+    lval *v = lenv_get_cached(root, c);
+    if (v)
     {
-      return lval_copy(e->vals[i]);
+      return v;
     }
   }
 
-  /* If no symbol check in parent otherwise error */
-  if (e->par)
+  for (lenv *x = e; x; x = x->par)
   {
-    return lenv_get(e->par, k);
-  }
-  else
-  {
-    return lval_err("Unbound Symbol '%s'", k->sym);
+    for (int i = 0; i < x->count; i++)
+    {
+      if (strcmp(x->syms[i], k->sym) == 0)
+      {
+        if (cacheable && x == root && i < LSYM_BASE)
+        {
+          lenv_cache_fill(c, root, i);
+        }
+        return lenv_get_copy(x->vals[i]);
+      }
+    }
+
+    for (int i = 0; x->base && i < x->base->count; i++)
+    {
+      if (strcmp(x->base->syms[i], k->sym) == 0)
+      {
+        if (cacheable && x == root && i < LSYM_BASE)
+        {
+          lenv_cache_fill(c, root, LSYM_BASE | i);
+        }
+        return lenv_get_copy(x->base->vals[i]);
+      }
+    }
+
+    /* User definitions shadow the builtins */
+    if (x->builtins)
+    {
+      int b = lbuiltin_index(k->sym);
+      if (b >= 0)
+      {
+        if (cacheable && x == root)
+        {
+          lenv_cache_fill(c, root, LSYM_BUILTIN | b);
+        }
+        return lval_builtin(lbuiltin_func(b));
+      }
+    }
   }
+
+  return lval_err("Unbound Symbol '%s'", k->sym);
 }
 
 lenv *lenv_copy(lenv *e)
 {
+  lmem.env_copies++;
+  if (++lmem.env_live > lmem.env_peak)
+  {
+    lmem.env_peak = lmem.env_live;
+  }
+
   lenv *n = malloc(sizeof(lenv));
   n->par = e->par;
   n->count = e->count;
+  n->builtins = e->builtins;
+  n->base = e->base;
+  n->interp = e->interp;
+  n->counted = NULL;
+  n->version = lenv_next_version();
   n->syms = malloc(sizeof(char *) * n->count);
   n->vals = malloc(sizeof(lval *) * n->count);
   for (int i = 0; i < e->count; i++)
@@ -189,6 +622,8 @@ lenv *lenv_copy(lenv *e)
 /* Add new variable to the environment */
 void lenv_put(lenv *e, lval *k, lval *v)
 {
+  lmem.env_puts++;
+
   /* Iterate over all items in environment */
   /* This is to see if variable already exits */
   for (int i = 0; i < e->count; i++)
@@ -212,8 +647,18 @@ void lenv_put(lenv *e, lval *k, lval *v)
   e->vals[e->count - 1] = lval_copy(v);
   e->syms[e->count - 1] = malloc(strlen(k->sym) + 1);
   strcpy(e->syms[e->count - 1], k->sym);
+  lfold_shadow(e, k->sym, 1);
+  lsym_local(e, k->sym, 1);
+
+  /* Cached lookups at this root may now resolve differently */
+  if (e->builtins)
+  {
+    e->version = lenv_next_version();
+  }
 }
 
+uint64_t lval_hash(lval *v);
+
 void lenv_def(lenv *e, lval *k, lval *v)
 {
   /* Iterate till e has no parent */
@@ -221,6 +666,12 @@ void lenv_def(lenv *e, lval *k, lval *v)
   {
     e = e->par;
   }
+  /* Hash global lists once so comparing their copies can stop early */
+  if (v->type == LVAL_QEXPR)
+  {
+    lval_hash(v);
+  }
+
   /* Put value in e */
   lenv_put(e, k, v);
 }
@@ -243,6 +694,10 @@ char *ltype_name(int t)
     return "S-Expression";
   case LVAL_QEXPR:
     return "Q-Expression";
+  case LVAL_CHAN:
+    return "Channel";
+  case LVAL_MAP:
+    return "Map";
   default:
     return "Unkown";
   }
@@ -250,8 +705,7 @@ char *ltype_name(int t)
 
 lval *lval_lambda(lval *formals, lval *body)
 {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_FUN;
+  lval *v = lval_alloc(LVAL_FUN);
 
   /* Set Builtin to Null */
   v->builtin = NULL;
@@ -262,109 +716,394 @@ lval *lval_lambda(lval *formals, lval *body)
   /* Set Formals and Body */
   v->formals = formals;
   v->body = body;
+  v->memo = NULL;
+  v->folded = NULL;
   return v;
 }
 
 /* Create a pointer to a new number lval */
 lval *lval_num(double x)
 {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_NUM;
+  lval *v = lval_alloc(LVAL_NUM);
   v->num = x;
   return v;
 }
 
-/* Create a pointer to a new error lval */
-lval *lval_err(char *fmt, ...)
-{
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_ERR;
+/* Errors keep their format and arguments and are only formatted when read */
 
-  /* Create a va list and initialize it */
-  va_list va;
-  va_start(va, fmt);
+#define LERR_MAX_ARGS 8
 
-  /* Allocate 512 bytes of space */
-  v->err = malloc(512);
-
-  /* printf the error string with a maximum of 511 characters */
-  vsnprintf(v->err, 511, fmt, va);
+typedef union
+{
+  long i;
+  double d;
+  char *s;
+} lerr_arg;
 
-  /* Reallocate to number of bytes actually used */
-  v->err = realloc(v->err, strlen(v->err) + 1);
+/* Shared by every copy of an error, static errors have negative refs and are never freed */
+struct lerr
+{
+  int refs;
+  char *fmt;
+  int nargs;
+  lerr_arg args[LERR_MAX_ARGS];
+  char strs[LERR_MAX_ARGS];
+  char *msg;
+};
 
-  /* Cleanup our va list */
-  va_end(va);
+/* Preallocated errors that need no formatting */
+lerr lerr_div_zero = {.refs = -1, .msg = "Division By Zero!"};
+lerr lerr_bad_number = {.refs = -1, .msg = "invalid number"};
+lerr lerr_no_key = {.refs = -1, .msg = "Key not found in map."};
+lerr lerr_unknown = {.refs = -1, .msg = "Unkown Function!"};
 
-  return v;
+/* Step over one conversion spec starting at '%', giving its conversion character */
+char *lerr_spec(char *p, char *conv, int *is_long)
+{
+  *is_long = 0;
+  for (p++; *p && strchr("-+ #0123456789.l", *p); p++)
+  {
+    *is_long |= *p == 'l';
+  }
+  *conv = *p;
+  return *p ? p + 1 : p;
 }
 
-/* Create a pointer to a new symbol lval */
-lval *lval_sym(char *s)
+lerr *lerr_new(char *fmt, va_list va)
 {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_SYM;
-  v->sym = malloc(strlen(s) + 1);
-  strcpy(v->sym, s);
-  return v;
+  lerr *e = malloc(sizeof(lerr));
+  e->refs = 1;
+  e->fmt = fmt;
+  e->nargs = 0;
+  e->msg = NULL;
+
+  /* Capture arguments by their conversion, strings are copied as callers free them */
+  for (char *p = fmt; *p;)
+  {
+    if (*p != '%')
+    {
+      p++;
+      continue;
+    }
+    char conv;
+    int is_long;
+    p = lerr_spec(p, &conv, &is_long);
+    if (conv == '%' || e->nargs == LERR_MAX_ARGS)
+    {
+      continue;
+    }
+
+    e->strs[e->nargs] = conv == 's';
+    lerr_arg *arg = &e->args[e->nargs++];
+    if (conv == 's')
+    {
+      /* Spelled as printf would so a missing name cannot crash the copy */
+      char *s = va_arg(va, char *);
+      arg->s = strdup(s ? s : "(null)");
+    }
+    else if (strchr("fgeFGE", conv))
+    {
+      arg->d = va_arg(va, double);
+    }
+    else
+    {
+      arg->i = is_long ? va_arg(va, long) : va_arg(va, int);
+    }
+  }
+  return e;
 }
 
-/* A pointer to a new empty sexpr lval */
-lval *lval_sexpr(void)
+/* Error from a finished message, taking ownership of it */
+lerr *lerr_msg(char *msg)
 {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_SEXPR;
-  v->count = 0;
-  v->cell = NULL;
-  return v;
+  lerr *e = calloc(1, sizeof(lerr));
+  e->refs = 1;
+  e->msg = msg;
+  return e;
 }
 
-/* A pointer to a new empty Qexpr lval */
-lval *lval_qexpr(void)
+void lerr_retain(lerr *e)
 {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_QEXPR;
-  v->count = 0;
-  v->cell = NULL;
-  return v;
+  if (e->refs >= 0)
+  {
+    __atomic_add_fetch(&e->refs, 1, __ATOMIC_RELAXED);
+  }
 }
 
-/* A pointer to a new empty lval_fun type */
-lval *lval_fun(lbuiltin func)
+void lerr_release(lerr *e)
 {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_FUN;
-  v->builtin = func;
-  return v;
+  if (e->refs < 0 || __atomic_sub_fetch(&e->refs, 1, __ATOMIC_ACQ_REL) > 0)
+  {
+    return;
+  }
+  for (int i = 0; i < e->nargs; i++)
+  {
+    if (e->strs[i])
+    {
+      free(e->args[i].s);
+    }
+  }
+  free(e->msg);
+  free(e);
 }
 
-/* Destructor for lval types */
-void lval_del(lval *v)
+/* Format each spec on its own with the captured argument */
+char *lerr_format(lerr *e)
 {
-  switch (v->type)
+  char *msg;
+  size_t len;
+  FILE *f = open_memstream(&msg, &len);
+  int i = 0;
+
+  for (char *p = e->fmt; *p;)
   {
-  case LVAL_FUN:
-    if (!v->builtin)
+    char *start = p;
+    if (*p != '%')
     {
-      lenv_del(v->env);
-      lval_del(v->formals);
-      lval_del(v->body);
+      while (*p && *p != '%')
+      {
+        p++;
+      }
+      fwrite(start, 1, p - start, f);
+      continue;
     }
-    break;
 
-  case LVAL_NUM:
-    break;
+    char conv;
+    int is_long;
+    p = lerr_spec(p, &conv, &is_long);
 
-  case LVAL_ERR:
-    free(v->err);
-    break;
-  case LVAL_SYM:
-    free(v->sym);
-    break;
+    char spec[32];
+    int n = p - start < 31 ? p - start : 31;
+    memcpy(spec, start, n);
+    spec[n] = '\0';
 
-  case LVAL_STR:
-    free(v->str);
-    break;
+    if (conv == '%')
+    {
+      fputc('%', f);
+    }
+    else if (i == e->nargs)
+    {
+      continue;
+    }
+    else if (conv == 's')
+    {
+      fprintf(f, spec, e->args[i++].s);
+    }
+    else if (strchr("fgeFGE", conv))
+    {
+      fprintf(f, spec, e->args[i++].d);
+    }
+    else if (is_long)
+    {
+      fprintf(f, spec, e->args[i++].i);
+    }
+    else
+    {
+      fprintf(f, spec, (int)e->args[i++].i);
+    }
+  }
+  fclose(f);
+
+  /* Same limit as the old fixed size buffer */
+  if (len > 511)
+  {
+    msg[511] = '\0';
+  }
+  return msg;
+}
+
+/* Message of an error lval, formatted on first use */
+char *lval_err_msg(lval *v)
+{
+  lerr *e = v->err;
+  char *msg = __atomic_load_n(&e->msg, __ATOMIC_ACQUIRE);
+  if (msg)
+  {
+    return msg;
+  }
+
+  /* Copies on other threads may race to format, the loser frees its own */
+  char *fresh = lerr_format(e);
+  if (!__atomic_compare_exchange_n(&e->msg, &msg, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+  {
+    free(fresh);
+    return msg;
+  }
+  return fresh;
+}
+
+/* Create a pointer to a new error lval */
+lval *lval_err(char *fmt, ...)
+{
+  lval *v = lval_alloc(LVAL_ERR);
+
+  va_list va;
+  va_start(va, fmt);
+  v->err = lerr_new(fmt, va);
+  va_end(va);
+
+  return v;
+}
+
+/* Error lval sharing a preallocated message */
+lval *lval_err_static(lerr *e)
+{
+  lval *v = lval_alloc(LVAL_ERR);
+  v->err = e;
+  return v;
+}
+
+/* Non-local errors */
+
+/* Cleanup run for a frame that an error unwinds past */
+typedef struct
+{
+  void (*fn)(void *);
+  void *ptr;
+} lcleanup;
+
+/* Handler installed by try, errors raised below it jump straight here */
+typedef struct ltry
+{
+  jmp_buf buf;
+  struct ltry *prev;
+  int depth;
+  lval *err;
+} ltry;
+
+/* Handler chain and cleanup stack, per thread and swapped with each task */
+typedef struct
+{
+  ltry *top;
+  lcleanup *stack;
+  int count;
+  int capacity;
+} lunwind;
+
+_Thread_local lunwind lunw;
+
+/* Frames only register cleanups while a handler is installed */
+void lcleanup_push(void (*fn)(void *), void *ptr)
+{
+  if (lunw.count == lunw.capacity)
+  {
+    lunw.capacity = lunw.capacity ? lunw.capacity * 2 : 64;
+    lunw.stack = realloc(lunw.stack, sizeof(lcleanup) * lunw.capacity);
+  }
+  lunw.stack[lunw.count].fn = fn;
+  lunw.stack[lunw.count].ptr = ptr;
+  lunw.count++;
+}
+
+void lcleanup_pop(void)
+{
+  lunw.count--;
+}
+
+/* Release the calling thread's cleanup stack before it exits */
+void lunwind_free(void)
+{
+  free(lunw.stack);
+  lunw.stack = NULL;
+  lunw.count = lunw.capacity = 0;
+}
+
+/* Jump to the nearest handler running cleanups on the way, without one the error is returned */
+lval *lval_raise(lval *err)
+{
+  ltry *t = lunw.top;
+  if (!t)
+  {
+    return err;
+  }
+
+  while (lunw.count > t->depth)
+  {
+    lcleanup *c = &lunw.stack[--lunw.count];
+    c->fn(c->ptr);
+  }
+  lunw.top = t->prev;
+  t->err = err;
+  longjmp(t->buf, 1);
+}
+
+/* Create a pointer to a new symbol lval */
+lval *lval_sym(char *s)
+{
+  lval *v = lval_alloc(LVAL_SYM);
+  v->sym = malloc(strlen(s) + 1);
+  strcpy(v->sym, s);
+  v->cache = lsymcache_new(s);
+  lmem.bytes += strlen(s) + 1;
+  return v;
+}
+
+/* A pointer to a new empty sexpr lval */
+lval *lval_sexpr(void)
+{
+  lval *v = lval_alloc(LVAL_SEXPR);
+  v->count = 0;
+  v->cell = NULL;
+  return v;
+}
+
+/* A pointer to a new empty Qexpr lval */
+lval *lval_qexpr(void)
+{
+  lval *v = lval_alloc(LVAL_QEXPR);
+  v->count = 0;
+  v->cell = NULL;
+  return v;
+}
+
+/* A pointer to a new empty lval_fun type */
+lval *lval_fun(lbuiltin func)
+{
+  lval *v = lval_alloc(LVAL_FUN);
+  v->builtin = func;
+  return v;
+}
+
+void lchan_release(lchan *c);
+void lmemo_release(lmemo *m);
+void lmap_del(lmap *m);
+
+/* Destructor for lval types */
+void lval_del(lval *v)
+{
+  switch (v->type)
+  {
+  case LVAL_FUN:
+    if (!v->builtin)
+    {
+      lenv_del(v->env);
+      lval_del(v->formals);
+      lval_del(v->body);
+      if (v->memo)
+      {
+        lmemo_release(v->memo);
+      }
+      if (v->folded)
+      {
+        lval_del(v->folded);
+      }
+    }
+    break;
+
+  case LVAL_NUM:
+    break;
+
+  case LVAL_ERR:
+    lerr_release(v->err);
+    break;
+  case LVAL_SYM:
+    free(v->sym);
+    lsymcache_release(v->cache);
+    break;
+
+  case LVAL_STR:
+    free(v->str);
+    break;
 
   case LVAL_QEXPR:
   case LVAL_SEXPR:
@@ -374,15 +1113,30 @@ void lval_del(lval *v)
     }
     free(v->cell);
     break;
+
+  case LVAL_CHAN:
+    lchan_release(v->chan);
+    break;
+
+  case LVAL_MAP:
+    lmap_del(v->map);
+    break;
   }
 
+  lmem.frees++;
+  lmem.live--;
   free(v);
 }
 
+void lchan_retain(lchan *c);
+void lmemo_retain(lmemo *m);
+lmap *lmap_copy(lmap *m);
+
 lval *lval_copy(lval *v)
 {
-  lval *x = malloc(sizeof(lval));
-  x->type = v->type;
+  lval *x = lval_alloc(v->type);
+  lmem.copies++;
+  lmem.copy_bytes += sizeof(lval);
 
   switch (v->type)
   {
@@ -398,6 +1152,12 @@ lval *lval_copy(lval *v)
       x->env = lenv_copy(v->env);
       x->formals = lval_copy(v->formals);
       x->body = lval_copy(v->body);
+      x->memo = v->memo;
+      if (x->memo)
+      {
+        lmemo_retain(x->memo);
+      }
+      x->folded = v->folded ? lval_copy(v->folded) : NULL;
     }
     break;
 
@@ -407,30 +1167,50 @@ lval *lval_copy(lval *v)
 
   /* Copy Strings using malloc and strcpy */
   case LVAL_ERR:
-    x->err = malloc(strlen(v->err) + 1);
-    strcpy(x->err, v->err);
+    x->err = v->err;
+    lerr_retain(x->err);
     break;
 
   case LVAL_SYM:
     x->sym = malloc(strlen(v->sym) + 1);
     strcpy(x->sym, v->sym);
+    x->cache = v->cache;
+    __atomic_add_fetch(&x->cache->refs, 1, __ATOMIC_RELAXED);
+    lmem.bytes += strlen(v->sym) + 1;
+    lmem.copy_bytes += strlen(v->sym) + 1;
     break;
 
   case LVAL_STR:
     x->str = malloc(strlen(v->str) + 1);
     strcpy(x->str, v->str);
+    lmem.bytes += strlen(v->str) + 1;
+    lmem.copy_bytes += strlen(v->str) + 1;
     break;
 
   /* Copy Lists by copying each sub-expression */
   case LVAL_SEXPR:
   case LVAL_QEXPR:
     x->count = v->count;
+    x->hash = v->hash;
+    x->hashed = v->hashed;
     x->cell = malloc(sizeof(lval *) * x->count);
+    lmem.bytes += sizeof(lval *) * x->count;
+    lmem.copy_bytes += sizeof(lval *) * x->count;
     for (int i = 0; i < x->count; i++)
     {
       x->cell[i] = lval_copy(v->cell[i]);
     }
     break;
+
+  /* Channels are shared, not copied */
+  case LVAL_CHAN:
+    x->chan = v->chan;
+    lchan_retain(x->chan);
+    break;
+
+  case LVAL_MAP:
+    x->map = lmap_copy(v->map);
+    break;
   }
 
   return x;
@@ -439,15 +1219,17 @@ lval *lval_copy(lval *v)
 /* Read lval number */
 lval *lval_read_num(mpc_ast_t *t)
 {
-  errno = 0;
-  double x = strtof(t->contents, NULL);
-  return errno != ERANGE ? lval_num(x) : lval_err("invalid number");
+  double x;
+  const char *end;
+  return numconv_parse(t->contents, &end, &x) == 1 ? lval_num(x) : lval_err_static(&lerr_bad_number);
 }
 
 lval *lval_add(lval *v, lval *x)
 {
   v->count++;
+  v->hashed = 0;
   v->cell = realloc(v->cell, sizeof(lval *) * v->count);
+  lmem.bytes += sizeof(lval *);
   v->cell[v->count - 1] = x;
   return v;
 }
@@ -532,24 +1314,24 @@ lval *lval_read(mpc_ast_t *t)
 }
 
 /* Forward declaration of lval_print function */
-void lval_print(lval *v);
+void lval_print(FILE *out, lval *v);
 
 /* Print S-Expression */
-void lval_expr_print(lval *v, char open, char close)
+void lval_expr_print(FILE *out, lval *v, char open, char close)
 {
-  putchar(open);
+  fputc(open, out);
   for (int i = 0; i < v->count; i++)
   {
-    lval_print(v->cell[i]);
+    lval_print(out, v->cell[i]);
     if (i != (v->count - 1))
     {
-      putchar(' ');
+      fputc(' ', out);
     }
   }
-  putchar(close);
+  fputc(close, out);
 }
 
-void lval_print_str(lval *v)
+void lval_print_str(FILE *out, lval *v)
 {
   /* Make a Copy of the string */
   char *escaped = malloc(strlen(v->str) + 1);
@@ -557,56 +1339,67 @@ void lval_print_str(lval *v)
   /* Pass it through the escape function */
   escaped = mpcf_escape(escaped);
   /* Print it between "" characters */
-  printf("\"%s\"", escaped);
+  fprintf(out, "\"%s\"", escaped);
   /* free the copied string */
   free(escaped);
 }
 
 /* Print an "lval" */
-void lval_print(lval *v)
+void lval_map_print(FILE *out, lval *v);
+
+void lval_print(FILE *out, lval *v)
 {
   switch (v->type)
   {
   case LVAL_FUN:
     if (v->builtin)
     {
-      printf("<builtin>");
+      fprintf(out, "<builtin>");
     }
     else
     {
-      printf("(\\ ");
-      lval_print(v->formals);
-      putchar(' ');
-      lval_print(v->body);
-      putchar(')');
+      fprintf(out, v->memo ? "(memo (\\ " : "(\\ ");
+      lval_print(out, v->formals);
+      fputc(' ', out);
+      lval_print(out, v->body);
+      fputs(v->memo ? "))" : ")", out);
     }
     break;
   case LVAL_NUM:
-    printf("%f", v->num);
+  {
+    char buf[NUMCONV_BUFSIZE];
+    fwrite(buf, 1, numconv_format(v->num, buf), out);
     break;
+  }
   case LVAL_ERR:
-    printf("Error: %s", v->err);
+    fprintf(out, "Error: %s", lval_err_msg(v));
     break;
   case LVAL_SYM:
-    printf("%s", v->sym);
+    fprintf(out, "%s", v->sym);
     break;
   case LVAL_STR:
-    lval_print_str(v);
+    lval_print_str(out, v);
     break;
   case LVAL_SEXPR:
-    lval_expr_print(v, '(', ')');
+    lval_expr_print(out, v, '(', ')');
     break;
   case LVAL_QEXPR:
-    lval_expr_print(v, '{', '}');
+    lval_expr_print(out, v, '{', '}');
+    break;
+  case LVAL_CHAN:
+    fprintf(out, "<channel>");
+    break;
+  case LVAL_MAP:
+    lval_map_print(out, v);
     break;
   }
 }
 
 /* Print an "lval" followed by a newline */
-void lval_println(lval *v)
+void lval_println(FILE *out, lval *v)
 {
-  lval_print(v);
-  putchar('\n');
+  lval_print(out, v);
+  fputc('\n', out);
 }
 
 lval *builtin_print(lenv *e, lval *a)
@@ -614,12 +1407,12 @@ lval *builtin_print(lenv *e, lval *a)
   /* Print each argument followed by a space */
   for (int i = 0; i < a->count; i++)
   {
-    lval_print(a->cell[i]);
-    putchar(' ');
+    lval_print(e->interp->out, a->cell[i]);
+    fputc(' ', e->interp->out);
   }
 
   /* Print a newline and delete arguments */
-  putchar('\n');
+  fputc('\n', e->interp->out);
   lval_del(a);
 
   return lval_sexpr();
@@ -635,6 +1428,7 @@ lval *lval_pop(lval *v, int i)
 
   /* Decrease the ccount of items in the list */
   v->count--;
+  v->hashed = 0;
 
   /* Reallocate the memory used */
   v->cell = realloc(v->cell, sizeof(lval *) * v->count);
@@ -649,6 +1443,83 @@ lval *lval_take(lval *v, int i)
   return x;
 }
 
+/* Constant folding */
+
+/* Can be passed to a folded call as is */
+int lfold_literal(lval *v)
+{
+  return v->type == LVAL_NUM || v->type == LVAL_STR || v->type == LVAL_QEXPR;
+}
+
+/* Fold S-expressions bottom up, Q-expressions inside are data and left alone */
+lval *lval_fold(lenv *e, lval *v, int *changed)
+{
+  for (int i = 0; i < v->count; i++)
+  {
+    if (v->cell[i]->type == LVAL_SEXPR)
+    {
+      v->cell[i] = lval_fold(e, v->cell[i], changed);
+    }
+  }
+
+  if (v->count < 2 || v->cell[0]->type != LVAL_SYM || !lfold_pure(v->cell[0]->sym))
+  {
+    return v;
+  }
+  for (int i = 1; i < v->count; i++)
+  {
+    if (!lfold_literal(v->cell[i]))
+    {
+      return v;
+    }
+  }
+
+  /* Errors such as division by zero are left to happen at run time */
+  lval *args = lval_sexpr();
+  for (int i = 1; i < v->count; i++)
+  {
+    lval_add(args, lval_copy(v->cell[i]));
+  }
+  /* Fold errors only abort the fold, they must not reach an enclosing try */
+  ltry *top = lunw.top;
+  lunw.top = NULL;
+  lval *r = lbuiltin_lookup(v->cell[0]->sym)(e, args);
+  lunw.top = top;
+  if (r->type == LVAL_ERR)
+  {
+    lval_del(r);
+    return v;
+  }
+
+  *changed = 1;
+  lval_del(v);
+  return r;
+}
+
+/* Folded copy of a lambda body, or NULL if there was nothing to fold */
+lval *lval_fold_body(lenv *e, lval *body)
+{
+  int changed = 0;
+  lval *x = lval_copy(body);
+  x->type = LVAL_SEXPR;
+  x = lval_fold(e, x, &changed);
+
+  if (!changed)
+  {
+    lval_del(x);
+    return NULL;
+  }
+
+  /* Whole body folded to a value, wrap it so evaluating the body gives it back */
+  if (x->type != LVAL_SEXPR)
+  {
+    return lval_add(lval_qexpr(), x);
+  }
+  x->type = LVAL_QEXPR;
+  x->hashed = 0;
+  return x;
+}
+
 lval *builtin_lambda(lenv *e, lval *a)
 {
   /* Check Two arguments, each of which are Q-Expressions */
@@ -669,7 +1540,9 @@ lval *builtin_lambda(lenv *e, lval *a)
   lval *body = lval_pop(a, 0);
   lval_del(a);
 
-  return lval_lambda(formals, body);
+  lval *f = lval_lambda(formals, body);
+  f->folded = lval_fold_body(e, body);
+  return f;
 }
 
 lval *builtin_head(lenv *e, lval *a)
@@ -743,7 +1616,9 @@ lval *builtin_tail(lenv *e, lval *a)
 
 lval *builtin_list(lenv *e, lval *a)
 {
+  /* Elements were replaced in place while this was an S-expression */
   a->type = LVAL_QEXPR;
+  a->hashed = 0;
   return a;
 }
 
@@ -784,693 +1659,3728 @@ lval *builtin_ord(lenv *e, lval *a, char *op)
   return lval_num(r);
 }
 
-lval *builtin_load(lenv *e, lval *a)
-{
-  LASSERT_COUNT(a, "load", 1);
-  LASSERT_TYPE(a, "load", 0, LVAL_STR);
-
-  /* Parse File given by string name */
-  mpc_result_t r;
-  if (mpc_parse_contents(a->cell[0]->str, Lispy, &r))
-  {
-    /* Read contents */
-    lval *expr = lval_read(r.output);
-    mpc_ast_delete(r.output);
+/* Compiled file cache */
 
-    /* Evaluate each Expression */
-    while (expr->count)
-    {
-      lval *x = lval_eval(e, lval_pop(expr, 0));
-      /* If Evaluation leads to an error print it */
-      if (x->type == LVAL_ERR)
-        lval_println(x);
-      lval_del(x);
-    }
+#define LCACHE_MAGIC "LSPC"
+/* Bump when literals read differently or the header layout changes, grammar
+   changes need no bump since its text is hashed into the header */
+#define LCACHE_VERSION 3
 
-    /* Delete expressions and arguments */
-    lval_del(expr);
-    lval_del(a);
+/* Growable byte buffer used to serialize lvals */
+typedef struct
+{
+  char *data;
+  size_t len;
+  size_t cap;
+} lbuf;
 
-    /* Return empty list */
-    return lval_sexpr();
-  }
-  else
+void lbuf_put(lbuf *b, const void *src, size_t n)
+{
+  if (b->len + n > b->cap)
   {
-    /* Get Parse Error as String */
-    char *err_msg = mpc_err_string(r.error);
-    mpc_err_delete(r.error);
-
-    /* Create new error message using it */
-    lval *err = lval_err("Could not load Library %s", err_msg);
-    free(err_msg);
-    lval_del(a);
-
-    /* Cleanup and return error */
-    return err;
+    b->cap = (b->len + n) * 2;
+    b->data = realloc(b->data, b->cap);
   }
+  memcpy(b->data + b->len, src, n);
+  b->len += n;
 }
 
-lval *builtin_error(lenv *e, lval *a)
+/* Write an unsigned integer using 7 bits per byte */
+void lbuf_put_varint(lbuf *b, uint64_t x)
 {
-  LASSERT_COUNT(a, "error", 1);
-  LASSERT_TYPE(a, "error", 0, LVAL_STR);
-
-  /* Construct Error from first argument */
-  lval *err = lval_err(a->cell[0]->str);
+  unsigned char c;
+  while (x >= 0x80)
+  {
+    c = (unsigned char)(x | 0x80);
+    lbuf_put(b, &c, 1);
+    x >>= 7;
+  }
+  c = (unsigned char)x;
+  lbuf_put(b, &c, 1);
+}
 
-  /* Delete arguments and return */
-  lval_del(a);
-  return err;
+void lbuf_put_str(lbuf *b, char *s)
+{
+  size_t n = strlen(s);
+  lbuf_put_varint(b, n);
+  lbuf_put(b, s, n);
 }
 
-int lval_eq(lval *x, lval *y)
+/* 64-bit FNV-1a hash */
+uint64_t lcache_hash(const char *data, size_t len)
 {
-  /* Different Types are always unequal */
-  if (x->type != y->type)
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; i++)
   {
-    return 0;
+    h ^= (unsigned char)data[i];
+    h *= 1099511628211ULL;
   }
+  return h;
+}
 
-  /* Compare Based upon type */
-  switch (x->type)
+/* Serialize a read (unevaluated) lval */
+void lcache_write_lval(lbuf *b, lval *v)
+{
+  unsigned char t = (unsigned char)v->type;
+  lbuf_put(b, &t, 1);
+  switch (v->type)
   {
-  /* Compare Number Value */
   case LVAL_NUM:
-    return (x->num == y->num);
-
-  /* Compare String Values */
+    lbuf_put(b, &v->num, sizeof(double));
+    break;
   case LVAL_ERR:
-    return (strcmp(x->err, y->err) == 0);
+    lbuf_put_str(b, lval_err_msg(v));
+    break;
   case LVAL_SYM:
-    return (strcmp(x->sym, y->sym) == 0);
+    lbuf_put_str(b, v->sym);
+    break;
   case LVAL_STR:
-    return (strcmp(x->str, y->str) == 0);
-
-  /* If builtin compare, otherwise compare formals and body */
-  case LVAL_FUN:
-    if (x->builtin || y->builtin)
-    {
-      return x->builtin == y->builtin;
-    }
-    else
-    {
-      return lval_eq(x->formals, y->formals) && lval_eq(x->body, y->body);
-    }
-
-  /* If list compare every indivdual element */
-  case LVAL_QEXPR:
+    lbuf_put_str(b, v->str);
+    break;
   case LVAL_SEXPR:
-    if (x->count != y->count)
+  case LVAL_QEXPR:
+    lbuf_put_varint(b, v->count);
+    for (int i = 0; i < v->count; i++)
     {
-      return 0;
+      lcache_write_lval(b, v->cell[i]);
     }
-    for (int i = 0; i < x->count; i++)
-    {
-      /* If any element not equal then whole list not equal */
-      if (!lval_eq(x->cell[i], y->cell[i]))
-      {
-        return 0;
-      }
-    }
-    /* Otherwise lists must be equal */
-    return 1;
     break;
   }
-  return 0;
 }
 
-lval *builtin_cmp(lenv *e, lval *a, char *op)
+/* Cursor over the contents of a cache file */
+typedef struct
 {
-  LASSERT_COUNT(a, op, 2);
-  int r;
-  if (strcmp(op, "==") == 0)
-  {
-    r = lval_eq(a->cell[0], a->cell[1]);
-  }
-  if (strcmp(op, "!=") == 0)
+  const char *data;
+  size_t len;
+  size_t pos;
+} lcursor;
+
+int lcursor_varint(lcursor *c, uint64_t *x)
+{
+  *x = 0;
+  for (int shift = 0; shift < 64; shift += 7)
   {
-    r = !lval_eq(a->cell[0], a->cell[1]);
+    if (c->pos >= c->len)
+    {
+      return 0;
+    }
+    unsigned char byte = (unsigned char)c->data[c->pos++];
+    *x |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+    {
+      return 1;
+    }
   }
-  lval_del(a);
-  return lval_num(r);
+  return 0;
 }
 
-lval *builtin_eq(lenv *e, lval *a)
+/* Read a length prefixed string into a newly allocated buffer */
+char *lcursor_str(lcursor *c)
 {
-  return builtin_cmp(e, a, "==");
+  uint64_t n;
+  if (!lcursor_varint(c, &n) || n > c->len - c->pos)
+  {
+    return NULL;
+  }
+  char *s = malloc(n + 1);
+  memcpy(s, c->data + c->pos, n);
+  s[n] = '\0';
+  c->pos += n;
+  return s;
 }
 
-lval *builtin_ne(lenv *e, lval *a)
+/* Deserialize an lval, returns NULL if the data is malformed */
+lval *lcache_read_lval(lcursor *c)
 {
-  return builtin_cmp(e, a, "!=");
-}
+  if (c->pos >= c->len)
+  {
+    return NULL;
+  }
 
-lval *builtin_gt(lenv *e, lval *a)
-{
-  return builtin_ord(e, a, ">");
+  int type = (unsigned char)c->data[c->pos++];
+  lval *v = NULL;
+  char *s;
+  uint64_t count;
+
+  switch (type)
+  {
+  case LVAL_NUM:
+    if (c->len - c->pos < sizeof(double))
+    {
+      return NULL;
+    }
+    v = lval_num(0);
+    memcpy(&v->num, c->data + c->pos, sizeof(double));
+    c->pos += sizeof(double);
+    return v;
+
+  case LVAL_ERR:
+  case LVAL_SYM:
+  case LVAL_STR:
+    if (!(s = lcursor_str(c)))
+    {
+      return NULL;
+    }
+    v = lval_alloc(type);
+    lmem.bytes += strlen(s) + 1;
+    /* Take ownership of the decoded string */
+    if (type == LVAL_ERR)
+      v->err = lerr_msg(s);
+    if (type == LVAL_SYM)
+    {
+      v->sym = s;
+      v->cache = lsymcache_new(s);
+    }
+    if (type == LVAL_STR)
+      v->str = s;
+    return v;
+
+  case LVAL_SEXPR:
+  case LVAL_QEXPR:
+    if (!lcursor_varint(c, &count) || count > c->len - c->pos)
+    {
+      return NULL;
+    }
+    v = type == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+    v->count = (int)count;
+    v->cell = malloc(sizeof(lval *) * count);
+    for (int i = 0; i < v->count; i++)
+    {
+      v->cell[i] = lcache_read_lval(c);
+      if (!v->cell[i])
+      {
+        /* Only delete the children read so far */
+        v->count = i;
+        lval_del(v);
+        return NULL;
+      }
+    }
+    return v;
+  }
+
+  return NULL;
 }
 
-lval *builtin_lt(lenv *e, lval *a)
+/* Read whole file into memory, returns NULL if it cannot be opened */
+char *lcache_slurp(char *path, size_t *len)
 {
-  return builtin_ord(e, a, "<");
+  FILE *f = fopen(path, "rb");
+  if (!f)
+  {
+    return NULL;
+  }
+
+  size_t cap = 4096;
+  char *data = malloc(cap + 1);
+  *len = 0;
+  size_t n;
+  while ((n = fread(data + *len, 1, cap - *len, f)) > 0)
+  {
+    *len += n;
+    if (*len == cap)
+    {
+      cap *= 2;
+      data = realloc(data, cap + 1);
+    }
+  }
+  fclose(f);
+
+  data[*len] = '\0';
+  return data;
 }
 
-lval *builtin_ge(lenv *e, lval *a)
+/* Cache file name is derived from the hash of the source path */
+char *lcache_path(char *dir, char *filename)
 {
-  return builtin_ord(e, a, ">=");
+  char *path = malloc(strlen(dir) + 32);
+  sprintf(path, "%s/%016llx.lspc", dir,
+          (unsigned long long)lcache_hash(filename, strlen(filename)));
+  return path;
 }
 
-lval *builtin_le(lenv *e, lval *a)
+/* Header stored before the forms: magic, version, grammar hash, source length and hash */
+void lcache_header(lbuf *b, size_t len, uint64_t hash)
 {
-  return builtin_ord(e, a, "<=");
+  unsigned char version = LCACHE_VERSION;
+  uint64_t grammar = lcache_hash(lispy_grammar, sizeof(lispy_grammar) - 1);
+  lbuf_put(b, LCACHE_MAGIC, 4);
+  lbuf_put(b, &version, 1);
+  lbuf_put(b, &grammar, sizeof(grammar));
+  lbuf_put_varint(b, len);
+  lbuf_put(b, &hash, sizeof(hash));
 }
 
-lval *builtin_if(lenv *e, lval *a)
+/* Look up pre-read forms for the given source, NULL on cache miss */
+lval *lcache_load(char *dir, char *filename, char *src, size_t src_len)
 {
-  LASSERT_COUNT(a, "if", 3);
-  LASSERT_TYPE(a, "if", 0, LVAL_NUM);
-  LASSERT_TYPE(a, "if", 1, LVAL_QEXPR);
-  LASSERT_TYPE(a, "if", 2, LVAL_QEXPR);
-
-  /* Mark Both Expressions as evaluable */
-  lval *x;
-  a->cell[1]->type = LVAL_SEXPR;
-  a->cell[2]->type = LVAL_SEXPR;
-
-  if (a->cell[0]->num)
+  char *path = lcache_path(dir, filename);
+  size_t len;
+  char *data = lcache_slurp(path, &len);
+  free(path);
+  if (!data)
   {
-    /* If condition is true evaluate first expression */
-    x = lval_eval(e, lval_pop(a, 1));
+    return NULL;
   }
-  else
+
+  /* Header must match the current source exactly */
+  lbuf header = {NULL, 0, 0};
+  lcache_header(&header, src_len, lcache_hash(src, src_len));
+
+  lval *expr = NULL;
+  if (len > header.len && memcmp(data, header.data, header.len) == 0)
   {
-    /* Otherwise evaluate second expression */
-    x = lval_eval(e, lval_pop(a, 2));
+    lcursor c = {data, len, header.len};
+    expr = lcache_read_lval(&c);
+    /* Reject trailing garbage or a non list root */
+    if (expr && (c.pos != len || expr->type != LVAL_SEXPR))
+    {
+      lval_del(expr);
+      expr = NULL;
+    }
   }
 
-  /* Delete argument list and return */
-  lval_del(a);
-  return x;
+  free(header.data);
+  free(data);
+  return expr;
 }
 
-lval *lval_join(lval *x, lval *y)
+/* Store pre-read forms, failures are silently ignored */
+void lcache_store(char *dir, char *filename, char *src, size_t src_len, lval *expr)
 {
-  for (int i = 0; i < y->count; i++)
+  mkdir(dir, 0755);
+
+  lbuf b = {NULL, 0, 0};
+  lcache_header(&b, src_len, lcache_hash(src, src_len));
+  lcache_write_lval(&b, expr);
+
+  /* Write to a temporary file and rename so readers never see partial data */
+  char *path = lcache_path(dir, filename);
+  char *tmp = malloc(strlen(path) + 8);
+  sprintf(tmp, "%s.XXXXXX", path);
+
+  int fd = mkstemp(tmp);
+  FILE *f = fd == -1 ? NULL : fdopen(fd, "wb");
+  if (f)
   {
-    x = lval_add(x, y->cell[i]);
+    int ok = fwrite(b.data, 1, b.len, f) == b.len;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp, path) != 0)
+    {
+      remove(tmp);
+    }
   }
-  free(y->cell);
-  free(y);
-  return x;
+
+  free(tmp);
+  free(path);
+  free(b.data);
 }
 
-lval *lval_call(lenv *e, lval *f, lval *a)
+/* Remove every cache file from the cache directory */
+void lcache_clear(char *dir)
 {
-  /* If builtin then simply call that */
-  if (f->builtin)
+  DIR *d = opendir(dir);
+  if (!d)
   {
-    return f->builtin(e, a);
+    return;
   }
 
-  /* Record Argument Counts */
-  int given = a->count;
-  int total = f->formals->count;
-
-  /* While arguments still remain to be processed */
-  while (a->count)
+  struct dirent *ent;
+  while ((ent = readdir(d)))
   {
-    /* If we've ran out of formal arguments to bind */
-    if (f->formals->count == 0)
+    size_t n = strlen(ent->d_name);
+    if (n > 5 && strcmp(ent->d_name + n - 5, ".lspc") == 0)
     {
-      lval_del(a);
-      return lval_err("Function pssed too many arguments. Got %i, Expected %i",
-                      given, total);
+      char *path = malloc(strlen(dir) + n + 2);
+      sprintf(path, "%s/%s", dir, ent->d_name);
+      remove(path);
+      free(path);
     }
+  }
+  closedir(d);
+}
 
-    /* Pop the first symbol from the formals */
-    lval *sym = lval_pop(f->formals, 0);
+lval *builtin_load(lenv *e, lval *a)
+{
+  LASSERT_COUNT(a, "load", 1);
+  LASSERT_TYPE(a, "load", 0, LVAL_STR);
 
-    /* Special Case to deal with '&' */
-    if (strcmp(sym->sym, "&") == 0)
+  linterp *in = e->interp;
+
+  /* Read file given by string name */
+  char *filename = a->cell[0]->str;
+  size_t len;
+  char *src = lcache_slurp(filename, &len);
+  if (!src)
+  {
+    lval *err = lval_err("Could not load Library %s: Unable to open file!", filename);
+    lval_del(a);
+    return err;
+  }
+
+  /* Unchanged files skip parsing by reusing the cached forms */
+  lval *expr = in->cache ? lcache_load(in->cache_dir, filename, src, len) : NULL;
+  if (!expr)
+  {
+    /* Parse contents */
+    mpc_result_t r;
+    if (!mpc_parse(filename, src, lispy_parser(in), &r))
     {
-      /* Ensure '&' is followed by another symbol */
-      if (f->formals->count != 1)
-      {
-        lval_del(a);
-        return lval_err(
-            "Function format invalid. Symbol '&' not followed by single symbol.");
-      }
+      /* Get Parse Error as String */
+      char *err_msg = mpc_err_string(r.error);
+      mpc_err_delete(r.error);
+
+      /* Create new error message using it */
+      lval *err = lval_err("Could not load Library %s", err_msg);
+      free(err_msg);
+      free(src);
+      lval_del(a);
 
-      /* Next formal should be bound to remaining arguments */
-      lval *nsym = lval_pop(f->formals, 0);
-      lenv_put(f->env, nsym, builtin_list(e, a));
-      lval_del(sym);
-      lval_del(nsym);
-      break;
+      /* Cleanup and return error */
+      return err;
     }
 
-    /* Pop the next argument from the list */
-    lval *val = lval_pop(a, 0);
+    /* Read contents */
+    expr = lval_read(r.output);
+    mpc_ast_delete(r.output);
 
-    /* Bind a copy into the function's environment */
-    lenv_put(f->env, sym, val);
+    if (in->cache)
+    {
+      lcache_store(in->cache_dir, filename, src, len, expr);
+    }
+  }
+  free(src);
 
-    /* Delete symbol and value */
-    lval_del(sym);
-    lval_del(val);
+  /* Evaluate each Expression */
+  while (expr->count)
+  {
+    lval *x = lval_eval(e, lval_pop(expr, 0));
+    /* If Evaluation leads to an error print it */
+    if (x->type == LVAL_ERR)
+      lval_println(in->out, x);
+    lval_del(x);
   }
 
-  /* Argument list is now bound so can be cleaned up */
+  /* Delete expressions and arguments */
+  lval_del(expr);
   lval_del(a);
 
-  /* If '&' remains in formal list bind to empty list */
-  if (f->formals->count > 0 && strcmp(f->formals->cell[0]->sym, "&") == 0)
-  {
-    /* Check to ensure that & is not passed invalidly */
-    if (f->formals->count != 2)
-    {
-      return lval_err(
-          "Function format invalid. Symbol '&' not followed by single symbol.");
-    }
+  /* Return empty list */
+  return lval_sexpr();
+}
 
-    /* Pop and delete '&' symbol */
-    lval_del(lval_pop(f->formals, 0));
+lval *builtin_error(lenv *e, lval *a)
+{
+  LASSERT_COUNT(a, "error", 1);
+  LASSERT_TYPE(a, "error", 0, LVAL_STR);
 
-    /* Pop next symbol and create empty list */
-    lval *sym = lval_pop(f->formals, 0);
-    lval *val = lval_qexpr();
+  /* Construct Error from first argument */
+  lval *err = lval_err("%s", a->cell[0]->str);
 
-    /* Bind to environment and delete */
-    lenv_put(f->env, sym, val);
-    lval_del(sym);
-    lval_del(val);
-  }
+  /* Delete arguments and raise */
+  lval_del(a);
+  return lval_raise(err);
+}
 
-  if (f->formals->count == 0)
-  {
-    /* Set the parent environment */
-    f->env->par = e;
+/* Evaluate body, on an error call handler with its message and return what it gives */
+lval *builtin_try(lenv *e, lval *a)
+{
+  LASSERT_COUNT(a, "try", 2);
+  LASSERT_TYPE(a, "try", 0, LVAL_QEXPR);
+  LASSERT_TYPE(a, "try", 1, LVAL_FUN);
+
+  lval *body = lval_pop(a, 0);
+  lval *handler = lval_take(a, 0);
+  body->type = LVAL_SEXPR;
 
-    /* Evaluate and return */
-    return builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
+  ltry t;
+  t.prev = lunw.top;
+  t.depth = lunw.count;
+  lval *x;
+  if (setjmp(t.buf) == 0)
+  {
+    lunw.top = &t;
+    x = lval_eval(e, body);
+    lunw.top = t.prev;
   }
   else
   {
-    /* Otherwise return partially evaluated faunction */
-    return lval_copy(f);
+    /* Raised from below, cleanups have run and the handler is already popped */
+    x = t.err;
   }
-}
 
-lval *builtin_join(lenv *e, lval *a)
-{
-  for (int i = 0; i < a->count; i++)
+  if (x->type != LVAL_ERR)
   {
-    LASSERT_TYPE(a, "join", i, LVAL_QEXPR);
+    lval_del(handler);
+    return x;
   }
 
-  lval *x = lval_pop(a, 0);
+  /* Handler is called through an expression so an error it raises unwinds cleanly */
+  lval *call = lval_add(lval_sexpr(), handler);
+  lval_add(call, lval_str(lval_err_msg(x)));
+  lval_del(x);
+  return lval_eval(e, call);
+}
 
-  while (a->count)
-  {
-    lval *y = lval_pop(a, 0);
-    x = lval_join(x, y);
-  }
+/* Hash maps */
 
-  lval_del(a);
-  return x;
-}
+/* Marks a deleted slot so probing continues past it */
+#define LMAP_TOMBSTONE ((lval *)&lmap_tombstone)
+static char lmap_tombstone;
 
-lval *builtin_op(lenv *e, lval *a, char *op)
+typedef struct
 {
-  /* Ensure all arguments are numbers */
-  for (int i = 0; i < a->count; i++)
-  {
-    LASSERT_TYPE(a, op, i, LVAL_NUM);
-  }
+  uint64_t hash;
+  lval *key;
+  lval *val;
+} lmap_slot;
 
-  /* Pop the first element */
-  lval *x = lval_pop(a, 0);
+/* Open addressing with linear probing, cap is a power of two */
+struct lmap
+{
+  int count;
+  int used;
+  int cap;
+  lmap_slot *slots;
+};
 
-  /* If no arguments and sub the perform unary negation */
-  if ((strcmp(op, "-") == 0) && a->count == 0)
+lval *lmap_get(lmap *m, lval *k);
+
+int lval_eq(lval *x, lval *y)
+{
+  /* Different Types are always unequal */
+  if (x->type != y->type)
   {
-    x->num = -x->num;
+    return 0;
   }
 
-  /* While there are still elements remaining */
-  while (a->count > 0)
+  /* Compare Based upon type */
+  switch (x->type)
   {
-    /* Pop the next element */
-    lval *y = lval_pop(a, 0);
-
-    if (strcmp(op, "+") == 0)
+  /* Compare Number Value */
+  case LVAL_NUM:
+    return (x->num == y->num);
+
+  /* Compare String Values */
+  case LVAL_ERR:
+    return x->err == y->err || strcmp(lval_err_msg(x), lval_err_msg(y)) == 0;
+  case LVAL_SYM:
+    return (strcmp(x->sym, y->sym) == 0);
+  case LVAL_STR:
+    return (strcmp(x->str, y->str) == 0);
+
+  /* If builtin compare, otherwise compare formals and body */
+  case LVAL_FUN:
+    if (x->builtin || y->builtin)
     {
-      x->num += y->num;
+      return x->builtin == y->builtin;
     }
-    if (strcmp(op, "-") == 0)
+    else
     {
-      x->num -= y->num;
+      return x->memo == y->memo && lval_eq(x->formals, y->formals) &&
+             lval_eq(x->body, y->body);
     }
-    if (strcmp(op, "*") == 0)
+
+  /* If list compare every indivdual element */
+  case LVAL_QEXPR:
+  case LVAL_SEXPR:
+    if (x->count != y->count)
     {
-      x->num *= y->num;
+      return 0;
     }
-    if (strcmp(op, "/") == 0)
+    /* Lists that have both been hashed can be told apart without walking them */
+    if (x->type == LVAL_QEXPR && x->hashed && y->hashed && x->hash != y->hash)
     {
-      if (y->num == 0)
+      return 0;
+    }
+    for (int i = 0; i < x->count; i++)
+    {
+      /* If any element not equal then whole list not equal */
+      if (!lval_eq(x->cell[i], y->cell[i]))
       {
-        lval_del(x);
-        lval_del(y);
-        x = lval_err("Division By Zero!");
-        break;
+        return 0;
       }
-      x->num /= y->num;
     }
-    if (strcmp(op, "%") == 0)
+    /* Otherwise lists must be equal */
+    return 1;
+    break;
+
+  /* Channels are equal only if they are the same channel */
+  case LVAL_CHAN:
+    return x->chan == y->chan;
+
+  /* Maps are equal if they hold equal values under the same keys */
+  case LVAL_MAP:
+    if (x->map->count != y->map->count)
     {
-      x->num = fmod(x->num, y->num);
+      return 0;
     }
-    if (strcmp(op, "add") == 0)
+    for (int i = 0; i < x->map->cap; i++)
     {
-      x->num += y->num;
+      lmap_slot *s = &x->map->slots[i];
+      if (s->key && s->key != LMAP_TOMBSTONE)
+      {
+        lval *v = lmap_get(y->map, s->key);
+        if (!v || !lval_eq(s->val, v))
+        {
+          return 0;
+        }
+      }
     }
-    if (strcmp(op, "sub") == 0)
+    return 1;
+  }
+  return 0;
+}
+
+/* Structural hash, values that are lval_eq hash the same */
+uint64_t lval_hash(lval *v)
+{
+  uint64_t h = 14695981039346656037ULL ^ v->type;
+  h *= 1099511628211ULL;
+
+  switch (v->type)
+  {
+  case LVAL_NUM:
+  {
+    /* 0 and -0 compare equal */
+    double x = v->num == 0 ? 0 : v->num;
+    return lcache_hash((char *)&x, sizeof(x)) ^ h;
+  }
+
+  case LVAL_ERR:
+    return lcache_hash(lval_err_msg(v), strlen(lval_err_msg(v))) ^ h;
+  case LVAL_SYM:
+    return lcache_hash(v->sym, strlen(v->sym)) ^ h;
+  case LVAL_STR:
+    return lcache_hash(v->str, strlen(v->str)) ^ h;
+
+  case LVAL_FUN:
+    if (v->builtin)
     {
-      x->num -= y->num;
+      return lcache_hash((char *)&v->builtin, sizeof(v->builtin)) ^ h;
     }
-    if (strcmp(op, "mult") == 0)
+    return ((lval_hash(v->formals) * 31) ^ lval_hash(v->body)) ^ h;
+
+  case LVAL_QEXPR:
+  case LVAL_SEXPR:
+    if (v->type == LVAL_QEXPR && v->hashed)
     {
-      x->num *= y->num;
+      return v->hash;
     }
-    if (strcmp(op, "div") == 0)
+    for (int i = 0; i < v->count; i++)
     {
-      if (y->num == 0)
+      h = (h ^ lval_hash(v->cell[i])) * 1099511628211ULL;
+    }
+
+    /* Only Q-expressions are cached, S-expressions are rewritten in place by evaluation */
+    if (v->type == LVAL_QEXPR)
+    {
+      v->hash = h;
+      v->hashed = 1;
+    }
+    return h;
+
+  case LVAL_CHAN:
+    return lcache_hash((char *)&v->chan, sizeof(v->chan)) ^ h;
+
+  /* Summed so that slot order does not matter */
+  case LVAL_MAP:
+  {
+    uint64_t sum = 0;
+    for (int i = 0; i < v->map->cap; i++)
+    {
+      lmap_slot *s = &v->map->slots[i];
+      if (s->key && s->key != LMAP_TOMBSTONE)
       {
-        lval_del(x);
-        lval_del(y);
-        x = lval_err("Division By Zero!");
-        break;
+        sum += s->hash * 31 + lval_hash(s->val);
       }
-      x->num /= y->num;
     }
-    if (strcmp(op, "mod") == 0)
+    return sum ^ h;
+  }
+  }
+
+  return h;
+}
+
+lmap *lmap_new(int cap)
+{
+  lmap *m = malloc(sizeof(lmap));
+  m->count = 0;
+  m->used = 0;
+  m->cap = cap;
+  m->slots = calloc(cap, sizeof(lmap_slot));
+  return m;
+}
+
+void lmap_del(lmap *m)
+{
+  for (int i = 0; i < m->cap; i++)
+  {
+    if (m->slots[i].key && m->slots[i].key != LMAP_TOMBSTONE)
     {
-      x->num = fmod(x->num, y->num);
+      lval_del(m->slots[i].key);
+      lval_del(m->slots[i].val);
     }
-    if (strcmp(op, "max") == 0)
+  }
+  free(m->slots);
+  free(m);
+}
+
+lmap *lmap_copy(lmap *m)
+{
+  lmap *n = lmap_new(m->cap);
+  n->count = m->count;
+  n->used = m->used;
+  for (int i = 0; i < m->cap; i++)
+  {
+    n->slots[i] = m->slots[i];
+    if (m->slots[i].key && m->slots[i].key != LMAP_TOMBSTONE)
     {
-      x->num = x->num > y->num ? x->num : y->num;
+      n->slots[i].key = lval_copy(m->slots[i].key);
+      n->slots[i].val = lval_copy(m->slots[i].val);
     }
-    if (strcmp(op, "min") == 0)
+  }
+  return n;
+}
+
+/* Slot holding an equal key, or the empty slot where it would go */
+lmap_slot *lmap_find(lmap *m, lval *k, uint64_t hash)
+{
+  lmap_slot *free_slot = NULL;
+  for (int i = hash & (m->cap - 1);; i = (i + 1) & (m->cap - 1))
+  {
+    lmap_slot *s = &m->slots[i];
+    if (!s->key)
     {
-      x->num = x->num < y->num ? x->num : y->num;
+      /* Reuse the first tombstone passed on the way */
+      return free_slot ? free_slot : s;
     }
-    if (strcmp(op, "pow") == 0)
+    if (s->key == LMAP_TOMBSTONE)
     {
-      x->num = pow(x->num, y->num);
+      free_slot = free_slot ? free_slot : s;
+    }
+    else if (s->hash == hash && lval_eq(s->key, k))
+    {
+      return s;
     }
-    lval_del(y);
   }
+}
 
-  lval_del(a);
-  return x;
+/* Double when live and deleted slots pass three quarters, dropping tombstones */
+void lmap_grow(lmap *m)
+{
+  if ((m->used + 1) * 4 <= m->cap * 3)
+  {
+    return;
+  }
+
+  lmap_slot *old = m->slots;
+  int old_cap = m->cap;
+  if (m->count * 2 >= m->cap)
+  {
+    m->cap *= 2;
+  }
+  m->slots = calloc(m->cap, sizeof(lmap_slot));
+  m->used = m->count;
+
+  for (int i = 0; i < old_cap; i++)
+  {
+    if (old[i].key && old[i].key != LMAP_TOMBSTONE)
+    {
+      *lmap_find(m, old[i].key, old[i].hash) = old[i];
+    }
+  }
+  free(old);
 }
 
-lval *builtin_add(lenv *e, lval *a)
+/* Set key to value, taking ownership of both */
+void lmap_put(lmap *m, lval *k, lval *v)
 {
-  return builtin_op(e, a, "+");
+  lmap_grow(m);
+
+  uint64_t hash = lval_hash(k);
+  lmap_slot *s = lmap_find(m, k, hash);
+  if (s->key && s->key != LMAP_TOMBSTONE)
+  {
+    lval_del(k);
+    lval_del(s->val);
+    s->val = v;
+    return;
+  }
+
+  if (!s->key)
+  {
+    m->used++;
+  }
+  m->count++;
+  s->hash = hash;
+  s->key = k;
+  s->val = v;
 }
 
-lval *builtin_sub(lenv *e, lval *a)
+lval *lmap_get(lmap *m, lval *k)
 {
-  return builtin_op(e, a, "-");
+  lmap_slot *s = lmap_find(m, k, lval_hash(k));
+  return s->key && s->key != LMAP_TOMBSTONE ? s->val : NULL;
 }
 
-lval *builtin_mul(lenv *e, lval *a)
+int lmap_remove(lmap *m, lval *k)
 {
-  return builtin_op(e, a, "*");
+  lmap_slot *s = lmap_find(m, k, lval_hash(k));
+  if (!s->key || s->key == LMAP_TOMBSTONE)
+  {
+    return 0;
+  }
+  lval_del(s->key);
+  lval_del(s->val);
+  s->key = LMAP_TOMBSTONE;
+  s->val = NULL;
+  m->count--;
+  return 1;
 }
 
-lval *builtin_div(lenv *e, lval *a)
+lval *lval_map(void)
 {
-  return builtin_op(e, a, "/");
+  lval *v = lval_alloc(LVAL_MAP);
+  v->map = lmap_new(8);
+  return v;
 }
 
-lval *builtin(lenv *e, lval *a, char *func)
+/* Only values with a stable notion of equality can be keys */
+int lmap_key_type(int t)
 {
-  if (strcmp("list", func) == 0)
+  return t == LVAL_NUM || t == LVAL_STR || t == LVAL_SYM;
+}
+
+#define LASSERT_KEY(args, func, index)                                                  \
+  LASSERT(args, lmap_key_type(args->cell[index]->type),                                \
+          "Function '%s' passed invalid key type for argument %i. Got %s, Expected %s.", \
+          func, index, ltype_name(args->cell[index]->type), "Number, String or Symbol");
+
+/* Build a map from a Q-expression of alternating keys and values */
+lval *builtin_map_new(lenv *e, lval *a)
+{
+  LASSERT_COUNT(a, "map-new", 1);
+  LASSERT_TYPE(a, "map-new", 0, LVAL_QEXPR);
+
+  lval *kvs = a->cell[0];
+  LASSERT(a, kvs->count % 2 == 0,
+          "Function 'map-new' passed an odd number of keys and values. Got %i.", kvs->count);
+  for (int i = 0; i < kvs->count; i += 2)
   {
-    return builtin_list(e, a);
+    LASSERT(a, lmap_key_type(kvs->cell[i]->type),
+            "Function 'map-new' passed invalid key type at index %i. Got %s, Expected %s.",
+            i, ltype_name(kvs->cell[i]->type), "Number, String or Symbol");
   }
-  if (strcmp("head", func) == 0)
+
+  lval *m = lval_map();
+  while (kvs->count)
   {
-    return builtin_head(e, a);
+    lval *k = lval_pop(kvs, 0);
+    lmap_put(m->map, k, lval_pop(kvs, 0));
   }
-  if (strcmp("tail", func) == 0)
+  lval_del(a);
+  return m;
+}
+
+/* Value for a key, or the default when given and the key is missing */
+lval *builtin_map_get(lenv *e, lval *a)
+{
+  LASSERT(a, a->count == 2 || a->count == 3,
+          "Function 'map-get' passed incorrect number of arguments. Got %i, Expected 2 or 3.",
+          a->count);
+  LASSERT_TYPE(a, "map-get", 0, LVAL_MAP);
+  LASSERT_KEY(a, "map-get", 1);
+
+  lval *v = lmap_get(a->cell[0]->map, a->cell[1]);
+  if (v)
   {
-    return builtin_tail(e, a);
+    v = lval_copy(v);
   }
-  if (strcmp("join", func) == 0)
+  else if (a->count == 3)
   {
-    return builtin_join(e, a);
+    v = lval_pop(a, 2);
   }
-  if (strcmp("eval", func) == 0)
+  else
   {
-    return builtin_eval(e, a);
+    v = lval_err_static(&lerr_no_key);
   }
-  if (strstr("+-/*%", func))
+  lval_del(a);
+  return v;
+}
+
+/* New map with the key set */
+lval *builtin_map_put(lenv *e, lval *a)
+{
+  LASSERT_COUNT(a, "map-put", 3);
+  LASSERT_TYPE(a, "map-put", 0, LVAL_MAP);
+  LASSERT_KEY(a, "map-put", 1);
+
+  lval *m = lval_pop(a, 0);
+  lval *k = lval_pop(a, 0);
+  lmap_put(m->map, k, lval_pop(a, 0));
+  lval_del(a);
+  return m;
+}
+
+/* New map without the key */
+lval *builtin_map_del(lenv *e, lval *a)
+{
+  LASSERT_COUNT(a, "map-del", 2);
+  LASSERT_TYPE(a, "map-del", 0, LVAL_MAP);
+  LASSERT_KEY(a, "map-del", 1);
+
+  lval *m = lval_pop(a, 0);
+  lmap_remove(m->map, a->cell[0]);
+  lval_del(a);
+  return m;
+}
+
+lval *builtin_map_keys(lenv *e, lval *a)
+{
+  LASSERT_COUNT(a, "map-keys", 1);
+  LASSERT_TYPE(a, "map-keys", 0, LVAL_MAP);
+
+  lmap *m = a->cell[0]->map;
+  lval *x = lval_qexpr();
+  for (int i = 0; i < m->cap; i++)
   {
-    return builtin_op(e, a, func);
+    if (m->slots[i].key && m->slots[i].key != LMAP_TOMBSTONE)
+    {
+      lval_add(x, lval_copy(m->slots[i].key));
+    }
   }
-  if (strcmp("add", func) == 0)
+  lval_del(a);
+  return x;
+}
+
+/* Printed as the expression that builds it */
+void lval_map_print(FILE *out, lval *v)
+{
+  fprintf(out, "(map-new {");
+  int first = 1;
+  for (int i = 0; i < v->map->cap; i++)
   {
-    return builtin_op(e, a, func);
+    lmap_slot *s = &v->map->slots[i];
+    if (s->key && s->key != LMAP_TOMBSTONE)
+    {
+      fputs(first ? "" : " ", out);
+      lval_print(out, s->key);
+      fputc(' ', out);
+      lval_print(out, s->val);
+      first = 0;
+    }
   }
-  if (strcmp("sub", func) == 0)
+  fprintf(out, "})");
+}
+
+lval *builtin_map_len(lenv *e, lval *a)
+{
+  LASSERT_COUNT(a, "map-len", 1);
+  LASSERT_TYPE(a, "map-len", 0, LVAL_MAP);
+
+  lval *x = lval_num(a->cell[0]->map->count);
+  lval_del(a);
+  return x;
+}
+
+lval *builtin_cmp(lenv *e, lval *a, char *op)
+{
+  LASSERT_COUNT(a, op, 2);
+  int r;
+  if (strcmp(op, "==") == 0)
   {
-    return builtin_op(e, a, func);
+    r = lval_eq(a->cell[0], a->cell[1]);
   }
-  if (strcmp("mult", func) == 0)
+  if (strcmp(op, "!=") == 0)
   {
-    return builtin_op(e, a, func);
+    r = !lval_eq(a->cell[0], a->cell[1]);
   }
-  if (strcmp("div", func) == 0)
-  {
-    return builtin_op(e, a, func);
+  lval_del(a);
+  return lval_num(r);
+}
+
+lval *builtin_eq(lenv *e, lval *a)
+{
+  return builtin_cmp(e, a, "==");
+}
+
+lval *builtin_ne(lenv *e, lval *a)
+{
+  return builtin_cmp(e, a, "!=");
+}
+
+lval *builtin_gt(lenv *e, lval *a)
+{
+  return builtin_ord(e, a, ">");
+}
+
+lval *builtin_lt(lenv *e, lval *a)
+{
+  return builtin_ord(e, a, "<");
+}
+
+lval *builtin_ge(lenv *e, lval *a)
+{
+  return builtin_ord(e, a, ">=");
+}
+
+lval *builtin_le(lenv *e, lval *a)
+{
+  return builtin_ord(e, a, "<=");
+}
+
+lval *builtin_if(lenv *e, lval *a)
+{
+  LASSERT_COUNT(a, "if", 3);
+  LASSERT_TYPE(a, "if", 0, LVAL_NUM);
+  LASSERT_TYPE(a, "if", 1, LVAL_QEXPR);
+  LASSERT_TYPE(a, "if", 2, LVAL_QEXPR);
+
+  /* Mark Both Expressions as evaluable */
+  a->cell[1]->type = LVAL_SEXPR;
+  a->cell[2]->type = LVAL_SEXPR;
+
+  /* Take the chosen branch and delete the rest before evaluating, so nothing is held across it */
+  lval *x = lval_pop(a, a->cell[0]->num ? 1 : 2);
+  lval_del(a);
+  return lval_eval(e, x);
+}
+
+lval *lval_join(lval *x, lval *y)
+{
+  for (int i = 0; i < y->count; i++)
+  {
+    x = lval_add(x, y->cell[i]);
+  }
+  free(y->cell);
+  free(y);
+  lmem.frees++;
+  lmem.live--;
+  return x;
+}
+
+lval *lmemo_call(lenv *e, lval *f, lval *a);
+int lbuiltin_holds(lbuiltin f);
+
+lval *lval_call(lenv *e, lval *f, lval *a)
+{
+  /* If builtin then simply call that */
+  if (f->builtin)
+  {
+    /* Builtins holding resources across evaluation see errors as values, not raised past them */
+    if (lunw.top && lbuiltin_holds(f->builtin))
+    {
+      ltry *top = lunw.top;
+      lunw.top = NULL;
+      lval *x = f->builtin(e, a);
+      lunw.top = top;
+      return x;
+    }
+    return f->builtin(e, a);
+  }
+
+  /* Memoized lambdas look up their arguments first, partial applications are not cached */
+  if (f->memo && f->env->count == 0)
+  {
+    return lmemo_call(e, f, a);
+  }
+
+  /* Record Argument Counts */
+  int given = a->count;
+  int total = f->formals->count;
+
+  /* While arguments still remain to be processed */
+  while (a->count)
+  {
+    /* If we've ran out of formal arguments to bind */
+    if (f->formals->count == 0)
+    {
+      lval_del(a);
+      return lval_err("Function pssed too many arguments. Got %i, Expected %i",
+                      given, total);
+    }
+
+    /* Pop the first symbol from the formals */
+    lval *sym = lval_pop(f->formals, 0);
+
+    /* Special Case to deal with '&' */
+    if (strcmp(sym->sym, "&") == 0)
+    {
+      /* Ensure '&' is followed by another symbol */
+      if (f->formals->count != 1)
+      {
+        lval_del(a);
+        return lval_err(
+            "Function format invalid. Symbol '&' not followed by single symbol.");
+      }
+
+      /* Next formal should be bound to remaining arguments */
+      lval *nsym = lval_pop(f->formals, 0);
+      lenv_put(f->env, nsym, builtin_list(e, a));
+      lval_del(sym);
+      lval_del(nsym);
+      break;
+    }
+
+    /* Pop the next argument from the list */
+    lval *val = lval_pop(a, 0);
+
+    /* Bind a copy into the function's environment */
+    lenv_put(f->env, sym, val);
+
+    /* Delete symbol and value */
+    lval_del(sym);
+    lval_del(val);
+  }
+
+  /* Argument list is now bound so can be cleaned up */
+  lval_del(a);
+
+  /* If '&' remains in formal list bind to empty list */
+  if (f->formals->count > 0 && strcmp(f->formals->cell[0]->sym, "&") == 0)
+  {
+    /* Check to ensure that & is not passed invalidly */
+    if (f->formals->count != 2)
+    {
+      return lval_err(
+          "Function format invalid. Symbol '&' not followed by single symbol.");
+    }
+
+    /* Pop and delete '&' symbol */
+    lval_del(lval_pop(f->formals, 0));
+
+    /* Pop next symbol and create empty list */
+    lval *sym = lval_pop(f->formals, 0);
+    lval *val = lval_qexpr();
+
+    /* Bind to environment and delete */
+    lenv_put(f->env, sym, val);
+    lval_del(sym);
+    lval_del(val);
+  }
+
+  if (f->formals->count == 0)
+  {
+    /* Set the parent environment */
+    f->env->par = e;
+    f->env->interp = e->interp;
+    lenv_count(f->env, e->interp);
+
+    /* Evaluate and return, folded constants are only valid while no builtin they used is shadowed */
+    lval *body = f->folded && e->interp && !e->interp->fold_shadows ? f->folded : f->body;
+    lval *r = builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(body)));
+    lenv_count(f->env, NULL);
+    return r;
+  }
+  else
+  {
+    /* Otherwise return partially evaluated faunction */
+    return lval_copy(f);
+  }
+}
+
+lval *builtin_join(lenv *e, lval *a)
+{
+  for (int i = 0; i < a->count; i++)
+  {
+    LASSERT_TYPE(a, "join", i, LVAL_QEXPR);
+  }
+
+  lval *x = lval_pop(a, 0);
+
+  while (a->count)
+  {
+    lval *y = lval_pop(a, 0);
+    x = lval_join(x, y);
+  }
+
+  lval_del(a);
+  return x;
+}
+
+lval *builtin_op(lenv *e, lval *a, char *op)
+{
+  /* Ensure all arguments are numbers */
+  for (int i = 0; i < a->count; i++)
+  {
+    LASSERT_TYPE(a, op, i, LVAL_NUM);
+  }
+
+  /* Pop the first element */
+  lval *x = lval_pop(a, 0);
+
+  /* If no arguments and sub the perform unary negation */
+  if ((strcmp(op, "-") == 0) && a->count == 0)
+  {
+    x->num = -x->num;
+  }
+
+  /* While there are still elements remaining */
+  while (a->count > 0)
+  {
+    /* Pop the next element */
+    lval *y = lval_pop(a, 0);
+
+    if (strcmp(op, "+") == 0)
+    {
+      x->num += y->num;
+    }
+    if (strcmp(op, "-") == 0)
+    {
+      x->num -= y->num;
+    }
+    if (strcmp(op, "*") == 0)
+    {
+      x->num *= y->num;
+    }
+    if (strcmp(op, "/") == 0)
+    {
+      if (y->num == 0)
+      {
+        lval_del(x);
+        lval_del(y);
+        x = lval_err_static(&lerr_div_zero);
+        break;
+      }
+      x->num /= y->num;
+    }
+    if (strcmp(op, "%") == 0)
+    {
+      x->num = fmod(x->num, y->num);
+    }
+    if (strcmp(op, "add") == 0)
+    {
+      x->num += y->num;
+    }
+    if (strcmp(op, "sub") == 0)
+    {
+      x->num -= y->num;
+    }
+    if (strcmp(op, "mult") == 0)
+    {
+      x->num *= y->num;
+    }
+    if (strcmp(op, "div") == 0)
+    {
+      if (y->num == 0)
+      {
+        lval_del(x);
+        lval_del(y);
+        x = lval_err_static(&lerr_div_zero);
+        break;
+      }
+      x->num /= y->num;
+    }
+    if (strcmp(op, "mod") == 0)
+    {
+      x->num = fmod(x->num, y->num);
+    }
+    if (strcmp(op, "max") == 0)
+    {
+      x->num = x->num > y->num ? x->num : y->num;
+    }
+    if (strcmp(op, "min") == 0)
+    {
+      x->num = x->num < y->num ? x->num : y->num;
+    }
+    if (strcmp(op, "pow") == 0)
+    {
+      x->num = pow(x->num, y->num);
+    }
+    lval_del(y);
+  }
+
+  lval_del(a);
+  return x;
+}
+
+lval *builtin_add(lenv *e, lval *a)
+{
+  return builtin_op(e, a, "+");
+}
+
+lval *builtin_sub(lenv *e, lval *a)
+{
+  return builtin_op(e, a, "-");
+}
+
+lval *builtin_mul(lenv *e, lval *a)
+{
+  return builtin_op(e, a, "*");
+}
+
+lval *builtin_div(lenv *e, lval *a)
+{
+  return builtin_op(e, a, "/");
+}
+
+lval *builtin(lenv *e, lval *a, char *func)
+{
+  if (strcmp("list", func) == 0)
+  {
+    return builtin_list(e, a);
+  }
+  if (strcmp("head", func) == 0)
+  {
+    return builtin_head(e, a);
+  }
+  if (strcmp("tail", func) == 0)
+  {
+    return builtin_tail(e, a);
+  }
+  if (strcmp("join", func) == 0)
+  {
+    return builtin_join(e, a);
+  }
+  if (strcmp("eval", func) == 0)
+  {
+    return builtin_eval(e, a);
+  }
+  if (strstr("+-/*%", func))
+  {
+    return builtin_op(e, a, func);
+  }
+  if (strcmp("add", func) == 0)
+  {
+    return builtin_op(e, a, func);
+  }
+  if (strcmp("sub", func) == 0)
+  {
+    return builtin_op(e, a, func);
+  }
+  if (strcmp("mult", func) == 0)
+  {
+    return builtin_op(e, a, func);
+  }
+  if (strcmp("div", func) == 0)
+  {
+    return builtin_op(e, a, func);
+  }
+  if (strcmp("mod", func) == 0)
+  {
+    return builtin_op(e, a, func);
+  }
+  if (strcmp("pow", func) == 0)
+  {
+    return builtin_op(e, a, func);
+  }
+  if (strcmp("min", func) == 0)
+  {
+    return builtin_op(e, a, func);
+  }
+  if (strcmp("max", func) == 0)
+  {
+    return builtin_op(e, a, func);
+  }
+  lval_del(a);
+  return lval_err_static(&lerr_unknown);
+}
+
+/* Deterministic call profiler */
+
+#define LPROF_BUCKETS 256
+
+/* Statistics for one function, lambdas are named by the symbol they were called through */
+typedef struct lprof_entry
+{
+  char *name;
+  int builtin;
+  unsigned long calls;
+
+  /* Inclusive figures are only counted by the outermost of recursive calls */
+  int active;
+  uint64_t total_ns;
+  uint64_t self_ns;
+  unsigned long total_allocs;
+  unsigned long self_allocs;
+
+  struct lprof_entry *next;
+} lprof_entry;
+
+typedef struct
+{
+  lprof_entry *entry;
+  uint64_t start_ns;
+  uint64_t child_ns;
+  unsigned long start_allocs;
+  unsigned long child_allocs;
+} lprof_frame;
+
+/* Calls in progress, each green task has its own swapped in while it runs */
+typedef struct
+{
+  lprof_frame *frames;
+  int depth;
+  int cap;
+
+  /* When the stack was switched out, its frames are not charged for the time away */
+  uint64_t paused_ns;
+  unsigned long paused_allocs;
+} lprof_stack;
+
+struct lprof
+{
+  lprof_entry *buckets[LPROF_BUCKETS];
+  int entries;
+
+  lprof_stack calls;
+};
+
+uint64_t lprof_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+lprof *lprof_new(void)
+{
+  return calloc(1, sizeof(lprof));
+}
+
+void lprof_del(lprof *p)
+{
+  for (int i = 0; i < LPROF_BUCKETS; i++)
+  {
+    lprof_entry *x = p->buckets[i];
+    while (x)
+    {
+      lprof_entry *next = x->next;
+      free(x->name);
+      free(x);
+      x = next;
+    }
+  }
+  free(p->calls.frames);
+  free(p);
+}
+
+/* Find or create the entry for a function */
+lprof_entry *lprof_intern(lprof *p, char *name, int builtin)
+{
+  unsigned h = (unsigned)lcache_hash(name, strlen(name)) % LPROF_BUCKETS;
+  for (lprof_entry *x = p->buckets[h]; x; x = x->next)
+  {
+    if (x->builtin == builtin && strcmp(x->name, name) == 0)
+    {
+      return x;
+    }
+  }
+
+  lprof_entry *x = calloc(1, sizeof(lprof_entry));
+  x->name = malloc(strlen(name) + 1);
+  strcpy(x->name, name);
+  x->builtin = builtin;
+  x->next = p->buckets[h];
+  p->buckets[h] = x;
+  p->entries++;
+  return x;
+}
+
+void lprof_enter(lprof *p, lprof_entry *x)
+{
+  lprof_stack *c = &p->calls;
+  if (c->depth == c->cap)
+  {
+    c->cap = c->cap ? c->cap * 2 : 64;
+    c->frames = realloc(c->frames, sizeof(lprof_frame) * c->cap);
+  }
+  lprof_frame *f = &c->frames[c->depth++];
+  f->entry = x;
+  f->child_ns = 0;
+  f->child_allocs = 0;
+  f->start_allocs = lval_allocs;
+  f->start_ns = lprof_now();
+
+  x->calls++;
+  x->active++;
+}
+
+void lprof_exit(lprof *p)
+{
+  uint64_t now = lprof_now();
+  lprof_stack *c = &p->calls;
+  lprof_frame *f = &c->frames[--c->depth];
+  lprof_entry *x = f->entry;
+
+  uint64_t total = now - f->start_ns;
+  unsigned long allocs = lval_allocs - f->start_allocs;
+  x->self_ns += total - f->child_ns;
+  x->self_allocs += allocs - f->child_allocs;
+  if (--x->active == 0)
+  {
+    x->total_ns += total;
+    x->total_allocs += allocs;
+  }
+
+  /* Charge the caller for the time spent here */
+  if (c->depth > 0)
+  {
+    c->frames[c->depth - 1].child_ns += total;
+    c->frames[c->depth - 1].child_allocs += allocs;
+  }
+}
+
+void lprof_pause(lprof_stack *c)
+{
+  c->paused_ns = lprof_now();
+  c->paused_allocs = lval_allocs;
+}
+
+/* Move the start of every frame past the time the stack was switched out */
+void lprof_resume(lprof_stack *c)
+{
+  uint64_t ns = lprof_now() - c->paused_ns;
+  unsigned long allocs = lval_allocs - c->paused_allocs;
+  for (int i = 0; i < c->depth; i++)
+  {
+    c->frames[i].start_ns += ns;
+    c->frames[i].start_allocs += allocs;
+  }
+}
+
+int lprof_cmp(const void *a, const void *b)
+{
+  const lprof_entry *x = *(lprof_entry *const *)a;
+  const lprof_entry *y = *(lprof_entry *const *)b;
+  return (x->self_ns < y->self_ns) - (x->self_ns > y->self_ns);
+}
+
+/* Entries sorted by self time, caller frees the array */
+lprof_entry **lprof_sorted(lprof *p)
+{
+  lprof_entry **xs = malloc(sizeof(lprof_entry *) * (p->entries + 1));
+  int n = 0;
+  for (int i = 0; i < LPROF_BUCKETS; i++)
+  {
+    for (lprof_entry *x = p->buckets[i]; x; x = x->next)
+    {
+      xs[n++] = x;
+    }
+  }
+  qsort(xs, n, sizeof(lprof_entry *), lprof_cmp);
+  return xs;
+}
+
+/* Human readable report */
+void lprof_report(lprof *p, FILE *out)
+{
+  lprof_entry **xs = lprof_sorted(p);
+  fprintf(out, "%10s %12s %12s %12s %12s  %s\n",
+          "calls", "total ms", "self ms", "total allocs", "self allocs", "function");
+  for (int i = 0; i < p->entries; i++)
+  {
+    lprof_entry *x = xs[i];
+    fprintf(out, "%10lu %12.3f %12.3f %12lu %12lu  %s%s\n",
+            x->calls, x->total_ns / 1e6, x->self_ns / 1e6,
+            x->total_allocs, x->self_allocs, x->name, x->builtin ? " (builtin)" : "");
+  }
+  free(xs);
+}
+
+/* Tab separated report for tools, one function per line */
+void lprof_write(lprof *p, char *filename)
+{
+  FILE *f = fopen(filename, "w");
+  if (!f)
+  {
+    return;
+  }
+  lprof_entry **xs = lprof_sorted(p);
+  fprintf(f, "function\tkind\tcalls\ttotal_ns\tself_ns\ttotal_allocs\tself_allocs\n");
+  for (int i = 0; i < p->entries; i++)
+  {
+    lprof_entry *x = xs[i];
+    fprintf(f, "%s\t%s\t%lu\t%llu\t%llu\t%lu\t%lu\n",
+            x->name, x->builtin ? "builtin" : "lambda", x->calls,
+            (unsigned long long)x->total_ns, (unsigned long long)x->self_ns,
+            x->total_allocs, x->self_allocs);
+  }
+  free(xs);
+  fclose(f);
+}
+
+/* Sampling profiler */
+/* A timer signal snapshots a shadow stack of function names kept by lval_eval_sexpr */
+
+#define LSAMPLE_MAX_DEPTH 4096
+#define LSAMPLE_SLOTS (1 << 21)
+
+/* Shadow call stack, frames beyond the maximum depth are not recorded */
+typedef struct
+{
+  char *frames[LSAMPLE_MAX_DEPTH];
+  volatile sig_atomic_t depth;
+} lsample_stack;
+
+struct lsampler
+{
+  /* Interned names so the stack only holds stable pointers */
+  lprof *names;
+
+  /* Stack of the main program, and the one being run which green tasks switch with a single store */
+  lsample_stack main;
+  lsample_stack *volatile stack;
+
+  /* Samples stored back to back as a depth followed by that many names */
+  char **slots;
+  volatile sig_atomic_t used;
+  volatile sig_atomic_t dropped;
+};
+
+/* Signals are process wide so only one sampler can be running */
+lsampler *lsampler_active;
+
+void lsampler_signal(int sig)
+{
+  lsampler *s = lsampler_active;
+  if (!s)
+  {
+    return;
+  }
+
+  lsample_stack *st = s->stack;
+  int depth = st->depth < LSAMPLE_MAX_DEPTH ? st->depth : LSAMPLE_MAX_DEPTH;
+  if (s->used + depth + 1 > LSAMPLE_SLOTS)
+  {
+    s->dropped++;
+    return;
+  }
+
+  char **slot = s->slots + s->used;
+  slot[0] = (char *)(intptr_t)depth;
+  memcpy(slot + 1, st->frames, sizeof(char *) * depth);
+  s->used += depth + 1;
+}
+
+/* Start sampling at the given frequency */
+lsampler *lsampler_start(int hz)
+{
+  lsampler *s = calloc(1, sizeof(lsampler));
+  s->names = lprof_new();
+  s->slots = malloc(sizeof(char *) * LSAMPLE_SLOTS);
+  s->stack = &s->main;
+  lsampler_active = s;
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = lsampler_signal;
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGPROF, &sa, NULL);
+
+  struct itimerval it;
+  it.it_interval.tv_sec = 0;
+  it.it_interval.tv_usec = 1000000 / hz;
+  it.it_value = it.it_interval;
+  setitimer(ITIMER_PROF, &it, NULL);
+  return s;
+}
+
+void lsampler_stop(lsampler *s)
+{
+  struct itimerval it;
+  memset(&it, 0, sizeof(it));
+  setitimer(ITIMER_PROF, &it, NULL);
+  lsampler_active = NULL;
+}
+
+void lsampler_push(lsampler *s, char *name, int builtin)
+{
+  lsample_stack *st = s->stack;
+  int depth = st->depth;
+  if (depth < LSAMPLE_MAX_DEPTH)
+  {
+    st->frames[depth] = lprof_intern(s->names, name, builtin)->name;
+  }
+  st->depth = depth + 1;
+}
+
+void lsampler_pop(lsampler *s)
+{
+  s->stack->depth--;
+}
+
+int lsample_cmp(const void *a, const void *b)
+{
+  char **x = *(char **const *)a;
+  char **y = *(char **const *)b;
+  intptr_t nx = (intptr_t)x[0];
+  intptr_t ny = (intptr_t)y[0];
+  for (intptr_t i = 1; i <= nx && i <= ny; i++)
+  {
+    int c = strcmp(x[i], y[i]);
+    if (c)
+    {
+      return c;
+    }
+  }
+  return (nx > ny) - (nx < ny);
+}
+
+void lsample_print(FILE *f, char **sample, int count)
+{
+  intptr_t n = (intptr_t)sample[0];
+  if (n == 0)
+  {
+    fputs("<toplevel>", f);
+  }
+  for (intptr_t i = 1; i <= n; i++)
+  {
+    fprintf(f, "%s%s", i > 1 ? ";" : "", sample[i]);
+  }
+  fprintf(f, " %i\n", count);
+}
+
+/* Write samples in folded stack format, one unique stack per line with its count */
+void lsampler_write(lsampler *s, char *filename)
+{
+  FILE *f = fopen(filename, "w");
+  if (!f)
+  {
+    return;
+  }
+
+  int n = 0;
+  char ***samples = malloc(sizeof(char **) * (s->used + 1));
+  for (int pos = 0; pos < s->used; pos += (intptr_t)s->slots[pos] + 1)
+  {
+    samples[n++] = s->slots + pos;
+  }
+  qsort(samples, n, sizeof(char **), lsample_cmp);
+
+  for (int i = 0; i < n;)
+  {
+    int j = i + 1;
+    while (j < n && lsample_cmp(&samples[i], &samples[j]) == 0)
+    {
+      j++;
+    }
+    lsample_print(f, samples[i], j - i);
+    i = j;
+  }
+
+  if (s->dropped)
+  {
+    fprintf(stderr, "Warning: %i samples dropped, sample buffer full\n", (int)s->dropped);
+  }
+  free(samples);
+  fclose(f);
+}
+
+void lsampler_del(lsampler *s)
+{
+  lprof_del(s->names);
+  free(s->slots);
+  free(s);
+}
+
+/* What an S-Expression evaluation owns at any point, released if an error unwinds past it */
+typedef struct
+{
+  lval *v;
+  int pending;
+  lval *f;
+  char *name;
+  lprof *prof;
+  lsampler *sampler;
+} leval_frame;
+
+void leval_unwind(void *p)
+{
+  leval_frame *fr = p;
+  if (fr->sampler)
+  {
+    lsampler_pop(fr->sampler);
+  }
+  if (fr->prof)
+  {
+    lprof_exit(fr->prof);
+  }
+  if (fr->v)
+  {
+    /* The child being evaluated was already consumed further down */
+    if (fr->pending >= 0)
+    {
+      fr->v->cell[fr->pending] = fr->v->cell[--fr->v->count];
+    }
+    lval_del(fr->v);
+  }
+  if (fr->f)
+  {
+    lval_del(fr->f);
+  }
+  free(fr->name);
+}
+
+lval *lval_eval_frame(lenv *e, leval_frame *fr)
+{
+  lval *v = fr->v;
+
+  /* Remember what the function was called as before it is evaluated */
+  lprof *prof = e->interp->prof;
+  lsampler *sampler = e->interp->sampler;
+  char *name = NULL;
+  if ((prof || sampler) && v->count > 1 && v->cell[0]->type == LVAL_SYM)
+  {
+    name = malloc(strlen(v->cell[0]->sym) + 1);
+    strcpy(name, v->cell[0]->sym);
+    fr->name = name;
+  }
+
+  /* Evaluate Children, stopping at the first error and dropping the rest unevaluated */
+  for (int i = 0; i < v->count; i++)
+  {
+    fr->pending = i;
+    v->cell[i] = lval_eval(e, v->cell[i]);
+    if (v->cell[i]->type == LVAL_ERR)
+    {
+      free(name);
+      return lval_take(v, i);
+    }
+  }
+  fr->pending = -1;
+
+  /* Empty Expression */
+  if (v->count == 0)
+  {
+    free(name);
+    return v;
+  }
+
+  /* Single Expression*/
+  if (v->count == 1)
+  {
+    free(name);
+    return lval_take(v, 0);
+  }
+
+  /* Ensure First Element is a function after evaluation */
+  lval *f = lval_pop(v, 0);
+  if (f->type != LVAL_FUN)
+  {
+    lval *err = lval_err("S-Expression starts with incorrect type. Got %s, Expected %s.",
+                         ltype_name(f->type), ltype_name(LVAL_FUN));
+    free(name);
+    lval_del(f);
+    lval_del(v);
+    return err;
+  }
+
+  /* If so call function to get result */
+  char *anon = f->builtin ? "<builtin>" : "<lambda>";
+  if (prof)
+  {
+    lprof_enter(prof, lprof_intern(prof, name ? name : anon, f->builtin != NULL));
+  }
+  if (sampler)
+  {
+    lsampler_push(sampler, name ? name : anon, f->builtin != NULL);
+  }
+  free(name);
+
+  /* Arguments now belong to the call */
+  fr->v = NULL;
+  fr->f = f;
+  fr->name = NULL;
+  fr->prof = prof;
+  fr->sampler = sampler;
+
+  lval *result = lval_call(e, f, v);
+
+  if (sampler)
+  {
+    lsampler_pop(sampler);
+  }
+  if (prof)
+  {
+    lprof_exit(prof);
+  }
+  lval_del(f);
+  return result;
+}
+
+lval *lval_eval_sexpr(lenv *e, lval *v)
+{
+  leval_frame fr = {v, -1, NULL, NULL, NULL, NULL};
+  if (!lunw.top)
+  {
+    return lval_eval_frame(e, &fr);
+  }
+
+  lcleanup_push(leval_unwind, &fr);
+  lval *result = lval_eval_frame(e, &fr);
+  lcleanup_pop();
+  return result;
+}
+
+lval *lval_eval(lenv *e, lval *v)
+{
+  if (v->type == LVAL_SYM)
+  {
+    lval *x = lenv_get(e, v);
+    lval_del(v);
+    return x;
+  }
+
+  if (v->type == LVAL_SEXPR)
+  {
+    return lval_eval_sexpr(e, v);
+  }
+
+  return v;
+}
+
+lval *lval_builtin(lbuiltin func)
+{
+  lval *v = lval_alloc(LVAL_FUN);
+  v->builtin = func;
+  return v;
+}
+
+lval *builtin_var(lenv *e, lval *a, char *func)
+{
+  LASSERT_TYPE(a, func, 0, LVAL_QEXPR);
+
+  /* First argument is symbol list */
+  lval *syms = a->cell[0];
+
+  /* Ensure all elements of first list are symbols */
+  for (int i = 0; i < syms->count; i++)
+  {
+    LASSERT(a, syms->cell[i]->type == LVAL_SYM,
+            "Function '%s' cannot define non-symbol. Got %s, Expected %s",
+            func, ltype_name(syms->cell[i]->type), ltype_name(LVAL_SYM));
+  }
+
+  /* Check correct number of symbols and values */
+  LASSERT(a, (syms->count == a->count - 1),
+          "Function '%s' passed too many arguments for symbols. Got %i, Expected %i",
+          func, syms->count, a->count - 1);
+
+  /* Assign copies of values to symbols */
+  for (int i = 0; i < syms->count; i++)
+  {
+    /* If 'def' define in globally. If 'put' define in locally. */
+    if (strcmp(func, "def") == 0)
+      lenv_def(e, syms->cell[i], a->cell[i + 1]);
+    if (strcmp(func, "=") == 0)
+      lenv_put(e, syms->cell[i], a->cell[i + 1]);
+  }
+
+  lval_del(a);
+  return lval_sexpr();
+}
+
+/* Define variable */
+lval *builtin_def(lenv *e, lval *a)
+{
+  return builtin_var(e, a, "def");
+}
+
+lval *builtin_put(lenv *e, lval *a)
+{
+  return builtin_var(e, a, "=");
+}
+
+/* Parallel map and fold */
+
+linterp *linterp_new(void);
+void linterp_set_env(linterp *in, lenv *e);
+void linterp_share_env(linterp *in, lenv *e);
+void linterp_del(linterp *in);
+
+/* Copy every binding visible from e into a single root environment */
+lenv *lenv_flatten(lenv *e)
+{
+  /* Collect the chain so outer frames are applied first, a shared base is outermost */
+  int depth = 1;
+  lenv *root = e;
+  while (root->par)
+  {
+    root = root->par;
+    depth++;
+  }
+  depth += root->base != NULL;
+  lenv **chain = malloc(sizeof(lenv *) * depth);
+  int i = 0;
+  for (lenv *x = e; x; x = x->par)
+  {
+    chain[i++] = x;
+  }
+  if (root->base)
+  {
+    chain[i++] = root->base;
+  }
+
+  lenv *n = lenv_new();
+  n->builtins = root->builtins;
+  for (i = depth - 1; i >= 0; i--)
+  {
+    for (int j = 0; j < chain[i]->count; j++)
+    {
+      /* Inner frames replace outer bindings of the same name */
+      lval *k = lval_sym(chain[i]->syms[j]);
+      lenv_put(n, k, chain[i]->vals[j]);
+      lval_del(k);
+    }
+  }
+
+  free(chain);
+  return n;
+}
+
+/* Double ended queue of chunk indices, owner pops the bottom, thieves the top */
+typedef struct
+{
+  pthread_mutex_t lock;
+  int top;
+  int bottom;
+} ldeque;
+
+typedef struct lpool lpool;
+typedef void (*lpool_task)(lpool *p, linterp *in, int chunk);
+
+struct lpool
+{
+  int workers;
+  int chunks;
+  ldeque *deques;
+  lpool_task task;
+
+  /* Environment each worker evaluates in a private copy of */
+  lenv *env;
+  linterp *base;
+
+  /* Work description */
+  lval *f;
+  lval *list;
+  int grain;
+  lval **results;
+};
+
+typedef struct
+{
+  lpool *pool;
+  int id;
+  int started;
+} lpool_worker;
+
+/* Take a chunk from the given deque, from the bottom if owner, else the top */
+int ldeque_take(ldeque *d, int owner)
+{
+  int chunk = -1;
+  pthread_mutex_lock(&d->lock);
+  if (d->top < d->bottom)
+  {
+    chunk = owner ? --d->bottom : d->top++;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return chunk;
+}
+
+/* Run chunks starting from the given worker's deque until every deque is empty */
+void lpool_drain(lpool *p, int id)
+{
+  /* Private interpreter so nothing mutable is shared with other workers */
+  linterp *in = linterp_new();
+  linterp_share_env(in, p->env);
+  in->out = p->base->out;
+  in->cache = p->base->cache;
+  in->cache_dir = p->base->cache_dir;
+
+  while (1)
+  {
+    int chunk = ldeque_take(&p->deques[id], 1);
+
+    /* Own deque is empty so steal from the others */
+    for (int i = 1; chunk == -1 && i < p->workers; i++)
+    {
+      chunk = ldeque_take(&p->deques[(id + i) % p->workers], 0);
+    }
+
+    /* No work is created while running so empty deques mean we are done */
+    if (chunk == -1)
+    {
+      break;
+    }
+    p->task(p, in, chunk);
+  }
+
+  in->out = stdout;
+  linterp_del(in);
+}
+
+void *lpool_work(void *arg)
+{
+  lpool_worker *w = arg;
+  lpool_drain(w->pool, w->id);
+  lmem_merge();
+  lunwind_free();
+  return NULL;
+}
+
+/* Split work into chunks, deal them out evenly and run until all are done */
+void lpool_run(lpool *p)
+{
+  /* Workers share one read only snapshot, a plain root is used as is since its thread waits here */
+  lenv *e = p->env;
+  if (e->par || e->base)
+  {
+    p->env = lenv_flatten(e);
+  }
+  p->deques = malloc(sizeof(ldeque) * p->workers);
+  for (int i = 0; i < p->workers; i++)
+  {
+    pthread_mutex_init(&p->deques[i].lock, NULL);
+    p->deques[i].top = (int)((long)p->chunks * i / p->workers);
+    p->deques[i].bottom = (int)((long)p->chunks * (i + 1) / p->workers);
+  }
+
+  pthread_t *threads = malloc(sizeof(pthread_t) * p->workers);
+  lpool_worker *args = malloc(sizeof(lpool_worker) * p->workers);
+  for (int i = 0; i < p->workers; i++)
+  {
+    args[i].pool = p;
+    args[i].id = i;
+    args[i].started = pthread_create(&threads[i], NULL, lpool_work, &args[i]) == 0;
+  }
+
+  /* Deques of workers that failed to start are run here, errors must not reach an enclosing try */
+  for (int i = 0; i < p->workers; i++)
+  {
+    if (!args[i].started)
+    {
+      ltry *top = lunw.top;
+      lunw.top = NULL;
+      lpool_drain(p, i);
+      lunw.top = top;
+    }
+  }
+  for (int i = 0; i < p->workers; i++)
+  {
+    if (args[i].started)
+    {
+      pthread_join(threads[i], NULL);
+    }
+  }
+  for (int i = 0; i < p->workers; i++)
+  {
+    pthread_mutex_destroy(&p->deques[i].lock);
+  }
+
+  if (p->env != e)
+  {
+    lenv_del(p->env);
+  }
+  free(p->deques);
+  free(threads);
+  free(args);
+}
+
+/* Call a copy of f with the given arguments */
+lval *lval_call_copy(lenv *e, lval *f, lval *a)
+{
+  lval *fn = lval_copy(f);
+  lval *r = lval_call(e, fn, a);
+  lval_del(fn);
+  return r;
+}
+
+void lpool_map_chunk(lpool *p, linterp *in, int chunk)
+{
+  int lo = chunk * p->grain;
+  int hi = lo + p->grain < p->list->count ? lo + p->grain : p->list->count;
+  for (int i = lo; i < hi; i++)
+  {
+    lval *args = lval_add(lval_sexpr(), lval_copy(p->list->cell[i]));
+    p->results[i] = lval_call_copy(in->env, p->f, args);
+  }
+}
+
+/* Left fold a chunk starting from its first element */
+void lpool_fold_chunk(lpool *p, linterp *in, int chunk)
+{
+  int lo = chunk * p->grain;
+  int hi = lo + p->grain < p->list->count ? lo + p->grain : p->list->count;
+  lval *acc = lval_copy(p->list->cell[lo]);
+  for (int i = lo + 1; i < hi && acc->type != LVAL_ERR; i++)
+  {
+    lval *args = lval_add(lval_sexpr(), acc);
+    args = lval_add(args, lval_copy(p->list->cell[i]));
+    acc = lval_call_copy(in->env, p->f, args);
+  }
+  p->results[chunk] = acc;
+}
+
+/* Check arguments shared by pmap and pfold and set up the pool */
+lval *lpool_init(lpool *p, lenv *e, lval *a, char *func, int first)
+{
+  LASSERT(a, a->count >= first + 2 && a->count <= first + 4,
+          "Function '%s' passed incorrect number of arguments. Got %i, Expected %i to %i",
+          func, a->count, first + 2, first + 4);
+  LASSERT_TYPE(a, func, 0, LVAL_FUN);
+  LASSERT_TYPE(a, func, first + 1, LVAL_QEXPR);
+  for (int i = first + 2; i < a->count; i++)
+  {
+    LASSERT_TYPE(a, func, i, LVAL_NUM);
+  }
+
+  p->f = a->cell[0];
+  p->list = a->cell[first + 1];
+  p->env = e;
+  p->base = e->interp;
+
+  /* Worker count defaults to the number of online processors */
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  p->workers = a->count > first + 3 ? (int)a->cell[first + 3]->num : (int)cpus;
+  if (cpus > 0 && p->workers > cpus)
+  {
+    p->workers = (int)cpus;
+  }
+  if (p->workers < 1)
+  {
+    p->workers = 1;
+  }
+
+  /* Default grain gives each worker several chunks to balance load */
+  int n = p->list->count;
+  p->grain = a->count > first + 2 ? (int)a->cell[first + 2]->num : n / (p->workers * 8);
+  if (p->grain < 1)
+  {
+    p->grain = 1;
+  }
+  p->chunks = (n + p->grain - 1) / p->grain;
+  if (p->workers > p->chunks)
+  {
+    p->workers = p->chunks;
+  }
+
+  return NULL;
+}
+
+/* Return the first error in results deleting everything else, or NULL */
+lval *lval_first_err(lval **results, int count)
+{
+  lval *err = NULL;
+  for (int i = 0; i < count; i++)
+  {
+    if (!err && results[i]->type == LVAL_ERR)
+    {
+      err = results[i];
+      continue;
+    }
+    if (err)
+    {
+      lval_del(results[i]);
+    }
+  }
+
+  if (err)
+  {
+    for (int i = 0; results[i] != err; i++)
+    {
+      lval_del(results[i]);
+    }
+  }
+  return err;
+}
+
+/* Apply function to every element in parallel, keeping the original order */
+lval *builtin_pmap(lenv *e, lval *a)
+{
+  lpool p;
+  lval *err = lpool_init(&p, e, a, "pmap", 0);
+  if (err)
+  {
+    return err;
+  }
+
+  int n = p.list->count;
+  p.task = lpool_map_chunk;
+  p.results = malloc(sizeof(lval *) * n);
+  if (n > 0)
+  {
+    lpool_run(&p);
+  }
+
+  lval *x = lval_first_err(p.results, n);
+  if (!x)
+  {
+    /* Results become the cells of the returned Q-Expression */
+    x = lval_qexpr();
+    x->count = n;
+    x->cell = p.results;
+    p.results = NULL;
+  }
+
+  free(p.results);
+  lval_del(a);
+  return x;
+}
+
+/* Fold an associative function over a list, chunks are folded in parallel */
+lval *builtin_pfold(lenv *e, lval *a)
+{
+  lpool p;
+  lval *err = lpool_init(&p, e, a, "pfold", 1);
+  if (err)
+  {
+    return err;
+  }
+
+  p.task = lpool_fold_chunk;
+  p.results = malloc(sizeof(lval *) * (p.chunks > 0 ? p.chunks : 1));
+  if (p.chunks > 0)
+  {
+    lpool_run(&p);
+  }
+
+  lval *acc = lval_first_err(p.results, p.chunks);
+  if (!acc)
+  {
+    /* Combine chunk results in order, starting from the initial value */
+    acc = lval_copy(a->cell[1]);
+    for (int i = 0; i < p.chunks; i++)
+    {
+      if (acc->type == LVAL_ERR)
+      {
+        lval_del(p.results[i]);
+        continue;
+      }
+      lval *args = lval_add(lval_add(lval_sexpr(), acc), p.results[i]);
+      acc = lval_call_copy(e, p.f, args);
+    }
+  }
+
+  free(p.results);
+  lval_del(a);
+  return acc;
+}
+
+/* Memoization */
+
+#define LMEMO_CAPACITY 1024
+
+/* Cached result, linked into a hash chain and the LRU list */
+typedef struct lmemo_entry
+{
+  uint64_t hash;
+  lval *args;
+  lval *result;
+  struct lmemo_entry *chain;
+
+  /* Most recently used first */
+  struct lmemo_entry *prev;
+  struct lmemo_entry *next;
+} lmemo_entry;
+
+/* Result cache shared by every copy of a memoized function */
+struct lmemo
+{
+  int refs;
+  pthread_mutex_t lock;
+
+  int capacity;
+  int count;
+  int nbuckets;
+  lmemo_entry **buckets;
+  lmemo_entry *head;
+  lmemo_entry *tail;
+
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+};
+
+lmemo *lmemo_new(int capacity)
+{
+  lmemo *m = calloc(1, sizeof(lmemo));
+  m->refs = 1;
+  pthread_mutex_init(&m->lock, NULL);
+  m->capacity = capacity;
+
+  /* Keep chains short when full */
+  m->nbuckets = 16;
+  while (m->nbuckets < capacity)
+  {
+    m->nbuckets *= 2;
+  }
+  m->buckets = calloc(m->nbuckets, sizeof(lmemo_entry *));
+  return m;
+}
+
+/* Copies may live on pool workers so the count is atomic */
+void lmemo_retain(lmemo *m)
+{
+  __atomic_add_fetch(&m->refs, 1, __ATOMIC_RELAXED);
+}
+
+void lmemo_release(lmemo *m)
+{
+  if (__atomic_sub_fetch(&m->refs, 1, __ATOMIC_ACQ_REL) > 0)
+  {
+    return;
+  }
+  for (lmemo_entry *x = m->head; x;)
+  {
+    lmemo_entry *next = x->next;
+    lval_del(x->args);
+    lval_del(x->result);
+    free(x);
+    x = next;
+  }
+  pthread_mutex_destroy(&m->lock);
+  free(m->buckets);
+  free(m);
+}
+
+void lmemo_unlink(lmemo *m, lmemo_entry *x)
+{
+  if (x->prev)
+  {
+    x->prev->next = x->next;
+  }
+  else
+  {
+    m->head = x->next;
+  }
+  if (x->next)
+  {
+    x->next->prev = x->prev;
+  }
+  else
+  {
+    m->tail = x->prev;
+  }
+}
+
+void lmemo_push_front(lmemo *m, lmemo_entry *x)
+{
+  x->prev = NULL;
+  x->next = m->head;
+  if (m->head)
+  {
+    m->head->prev = x;
+  }
+  m->head = x;
+  if (!m->tail)
+  {
+    m->tail = x;
+  }
+}
+
+/* Find the entry for equal arguments, caller holds the lock */
+lmemo_entry *lmemo_find(lmemo *m, uint64_t hash, lval *args)
+{
+  lmemo_entry *x = m->buckets[hash & (m->nbuckets - 1)];
+  while (x && !(x->hash == hash && lval_eq(x->args, args)))
+  {
+    x = x->chain;
+  }
+  return x;
+}
+
+/* Remove the least recently used entry, caller holds the lock */
+void lmemo_evict(lmemo *m)
+{
+  lmemo_entry *x = m->tail;
+  lmemo_entry **p = &m->buckets[x->hash & (m->nbuckets - 1)];
+  while (*p != x)
+  {
+    p = &(*p)->chain;
+  }
+  *p = x->chain;
+  lmemo_unlink(m, x);
+  lval_del(x->args);
+  lval_del(x->result);
+  free(x);
+  m->count--;
+  m->evictions++;
+}
+
+void lmemo_insert(lmemo *m, uint64_t hash, lval *args, lval *result)
+{
+  pthread_mutex_lock(&m->lock);
+
+  /* Another thread may have computed the same call meanwhile */
+  if (lmemo_find(m, hash, args))
+  {
+    pthread_mutex_unlock(&m->lock);
+    lval_del(args);
+    lval_del(result);
+    return;
+  }
+
+  lmemo_entry *x = malloc(sizeof(lmemo_entry));
+  x->hash = hash;
+  x->args = args;
+  x->result = result;
+  x->chain = m->buckets[hash & (m->nbuckets - 1)];
+  m->buckets[hash & (m->nbuckets - 1)] = x;
+  lmemo_push_front(m, x);
+
+  if (++m->count > m->capacity)
+  {
+    lmemo_evict(m);
+  }
+  pthread_mutex_unlock(&m->lock);
+}
+
+/* Call a memoized function, answering from the cache when the arguments were seen before */
+lval *lmemo_call(lenv *e, lval *f, lval *a)
+{
+  lmemo *m = f->memo;
+  uint64_t hash = lval_hash(a);
+
+  pthread_mutex_lock(&m->lock);
+  lmemo_entry *x = lmemo_find(m, hash, a);
+  if (x)
+  {
+    m->hits++;
+    lmemo_unlink(m, x);
+    lmemo_push_front(m, x);
+    lval *result = lval_copy(x->result);
+    pthread_mutex_unlock(&m->lock);
+    lval_del(a);
+    return result;
+  }
+  m->misses++;
+  pthread_mutex_unlock(&m->lock);
+
+  /* Detach the cache so the call itself runs as a plain lambda, errors come back as values */
+  lval *args = lval_copy(a);
+  ltry *top = lunw.top;
+  lunw.top = NULL;
+  f->memo = NULL;
+  lval *result = lval_call(e, f, a);
+  f->memo = m;
+  lunw.top = top;
+
+  /* Errors are not cached */
+  if (result->type == LVAL_ERR)
+  {
+    lval_del(args);
+    return result;
+  }
+  lmemo_insert(m, hash, args, lval_copy(result));
+  return result;
+}
+
+lval *builtin_memo(lenv *e, lval *a)
+{
+  LASSERT(a, a->count == 1 || a->count == 2,
+          "Function 'memo' passed incorrect number of arguments. Got %i, Expected 1 or 2.",
+          a->count);
+  LASSERT_TYPE(a, "memo", 0, LVAL_FUN);
+  LASSERT(a, !a->cell[0]->builtin && !a->cell[0]->memo && a->cell[0]->env->count == 0,
+          "Function 'memo' can only memoize a lambda that has no bound arguments.");
+
+  int capacity = LMEMO_CAPACITY;
+  if (a->count == 2)
+  {
+    LASSERT_TYPE(a, "memo", 1, LVAL_NUM);
+    capacity = (int)a->cell[1]->num;
+    LASSERT(a, capacity > 0, "Function 'memo' capacity must be positive. Got %i.", capacity);
+  }
+
+  lval *f = lval_take(a, 0);
+  f->memo = lmemo_new(capacity);
+  return f;
+}
+
+/* Cache counters as a list of {name value} pairs */
+lval *builtin_memo_stats(lenv *e, lval *a)
+{
+  LASSERT_COUNT(a, "memo-stats", 1);
+  LASSERT_TYPE(a, "memo-stats", 0, LVAL_FUN);
+  LASSERT(a, a->cell[0]->memo, "Function 'memo-stats' passed a function that is not memoized.");
+
+  lmemo *m = a->cell[0]->memo;
+  pthread_mutex_lock(&m->lock);
+  char *names[] = {"hits", "misses", "evictions", "size", "capacity"};
+  double vals[] = {m->hits, m->misses, m->evictions, m->count, m->capacity};
+  pthread_mutex_unlock(&m->lock);
+  lval_del(a);
+
+  lval *x = lval_qexpr();
+  for (int i = 0; i < 5; i++)
+  {
+    lval *pair = lval_qexpr();
+    lval_add(pair, lval_sym(names[i]));
+    lval_add(pair, lval_num(vals[i]));
+    lval_add(x, pair);
+  }
+  return x;
+}
+
+/* Green threads and channels */
+
+/* As deep as the main thread's stack, pages are only committed once a task touches them */
+#define LTASK_STACK_SIZE (8 * 1024 * 1024)
+
+/* Bounded queue of values shared by every copy of a channel lval */
+struct lchan
+{
+  /* Copies may live in pmap and pfold workers, so counted atomically */
+  int refs;
+
+  /* Only tasks of the creating interpreter can wait on the queue */
+  linterp *owner;
+
+  int cap;
+  int count;
+  int head;
+  lval **buf;
+};
+
+void lchan_retain(lchan *c)
+{
+  __atomic_add_fetch(&c->refs, 1, __ATOMIC_RELAXED);
+}
+
+void lchan_release(lchan *c)
+{
+  if (__atomic_sub_fetch(&c->refs, 1, __ATOMIC_ACQ_REL) > 0)
+  {
+    return;
+  }
+  for (int i = 0; i < c->count; i++)
+  {
+    lval_del(c->buf[(c->head + i) % c->cap]);
+  }
+  free(c->buf);
+  free(c);
+}
+
+/* Can a send or receive proceed without blocking */
+int lchan_ready(lchan *c, int sending)
+{
+  return sending ? c->count < c->cap : c->count > 0;
+}
+
+lval *lval_chan(linterp *in, int cap)
+{
+  lval *v = lval_alloc(LVAL_CHAN);
+  v->chan = malloc(sizeof(lchan));
+  v->chan->refs = 1;
+  v->chan->owner = in;
+  v->chan->cap = cap;
+  v->chan->count = 0;
+  v->chan->head = 0;
+  v->chan->buf = malloc(sizeof(lval *) * cap);
+  return v;
+}
+
+/* Coroutine running a function call on its own stack */
+typedef struct
+{
+  ucontext_t ctx;
+  char *stack;
+  linterp *in;
+  lval *f;
+  lval *args;
+  int done;
+
+  /* Handlers and cleanups of the task, swapped in while it runs */
+  lunwind unwind;
+
+  /* Profiled calls of the task, swapped in the same way */
+  lprof_stack prof;
+
+  /* Sampled calls of the task, allocated when first run under the sampler */
+  lsample_stack *sample;
+
+  /* Channel operation the task is blocked on, if any */
+  int blocked;
+  lchan *wait_chan;
+  int wait_send;
+} ltask;
+
+/* Cooperative scheduler, tasks only run while the main program waits or yields */
+struct lsched
+{
+  ltask **tasks;
+  int count;
+
+  /* Task currently running, NULL when in the main program */
+  ltask *current;
+
+  /* Where a task returns to when it yields or finishes */
+  ucontext_t ret;
+};
+
+/* Entry point of every task, pointer is split over two ints for makecontext */
+void ltask_entry(unsigned int hi, unsigned int lo)
+{
+  ltask *t = (ltask *)(((uintptr_t)hi << 16 << 16) | (uintptr_t)lo);
+
+  lval *x = lval_call(t->in->env, t->f, t->args);
+  if (x->type == LVAL_ERR)
+  {
+    lval_println(t->in->out, x);
+  }
+  lval_del(x);
+
+  t->done = 1;
+}
+
+/* Stacks are mapped above an inaccessible page so an overflow faults instead of overwriting memory */
+char *ltask_stack_new(void)
+{
+  size_t guard = sysconf(_SC_PAGESIZE);
+  char *base = mmap(NULL, guard + LTASK_STACK_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED)
+  {
+    return NULL;
+  }
+  if (mprotect(base, guard, PROT_NONE) != 0)
+  {
+    munmap(base, guard + LTASK_STACK_SIZE);
+    return NULL;
+  }
+  return base + guard;
+}
+
+void ltask_stack_del(char *stack)
+{
+  size_t guard = sysconf(_SC_PAGESIZE);
+  munmap(stack - guard, guard + LTASK_STACK_SIZE);
+}
+
+void ltask_del(ltask *t)
+{
+  lval_del(t->f);
+  free(t->unwind.stack);
+  free(t->prof.frames);
+  free(t->sample);
+  ltask_stack_del(t->stack);
+  free(t);
+}
+
+/* Resume every live task once, returns how many did not stay blocked */
+int lsched_step(lsched *s)
+{
+  int progress = 0;
+  for (int i = 0; i < s->count; i++)
+  {
+    ltask *t = s->tasks[i];
+
+    /* Skip tasks whose channel operation still cannot proceed */
+    if (t->blocked && !lchan_ready(t->wait_chan, t->wait_send))
+    {
+      continue;
+    }
+
+    lprof *prof = t->in->prof;
+    lprof_stack calls;
+    if (prof)
+    {
+      lprof_pause(&prof->calls);
+      calls = prof->calls;
+      prof->calls = t->prof;
+      lprof_resume(&prof->calls);
+    }
+
+    lsampler *sampler = t->in->sampler;
+    lsample_stack *sampled;
+    if (sampler)
+    {
+      if (!t->sample)
+      {
+        t->sample = calloc(1, sizeof(lsample_stack));
+      }
+      sampled = sampler->stack;
+      sampler->stack = t->sample;
+    }
+
+    lunwind main = lunw;
+    lunw = t->unwind;
+    s->current = t;
+    swapcontext(&s->ret, &t->ctx);
+    s->current = NULL;
+    t->unwind = lunw;
+    lunw = main;
+
+    if (sampler)
+    {
+      sampler->stack = sampled;
+    }
+
+    if (prof)
+    {
+      lprof_pause(&prof->calls);
+      t->prof = prof->calls;
+      prof->calls = calls;
+      lprof_resume(&prof->calls);
+    }
+
+    /* Resumed tasks got their channel operation through even if they blocked again */
+    progress++;
+  }
+
+  /* Remove finished tasks keeping the order of the others */
+  int n = 0;
+  for (int i = 0; i < s->count; i++)
+  {
+    if (s->tasks[i]->done)
+    {
+      ltask_del(s->tasks[i]);
+    }
+    else
+    {
+      s->tasks[n++] = s->tasks[i];
+    }
+  }
+  s->count = n;
+
+  return progress;
+}
+
+/* Give up the processor, a task goes back to the scheduler, main runs a round */
+void lsched_yield(linterp *in)
+{
+  lsched *s = in->sched;
+  if (!s)
+  {
+    return;
+  }
+  if (s->current)
+  {
+    swapcontext(&s->current->ctx, &s->ret);
+  }
+  else
+  {
+    lsched_step(s);
+  }
+}
+
+/* Wait until a channel operation can proceed, 0 if it never can */
+int lsched_wait(linterp *in, lchan *c, int sending)
+{
+  lsched *s = in->sched;
+  while (!lchan_ready(c, sending))
+  {
+    if (s && s->current)
+    {
+      ltask *t = s->current;
+      t->blocked = 1;
+      t->wait_chan = c;
+      t->wait_send = sending;
+      swapcontext(&t->ctx, &s->ret);
+      t->blocked = 0;
+      continue;
+    }
+
+    /* Main program is blocked so nothing but tasks can make progress */
+    if (!s || !s->count || (!lsched_step(s) && !lchan_ready(c, sending)))
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Run tasks until all have finished or none can make progress */
+void lsched_drain(linterp *in)
+{
+  lsched *s = in->sched;
+  while (s && s->count)
+  {
+    if (!lsched_step(s))
+    {
+      fprintf(in->out, "Error: %i task(s) deadlocked\n", s->count);
+      break;
+    }
+  }
+}
+
+/* Free the scheduler, tasks still suspended are discarded */
+void lsched_del(lsched *s)
+{
+  for (int i = 0; i < s->count; i++)
+  {
+    ltask_del(s->tasks[i]);
+  }
+  free(s->tasks);
+  free(s);
+}
+
+lval *builtin_spawn(lenv *e, lval *a)
+{
+  LASSERT(a, a->count >= 1,
+          "Function 'spawn' passed incorrect number of arguments. Got %i, Expected at least %i",
+          a->count, 1);
+  LASSERT_TYPE(a, "spawn", 0, LVAL_FUN);
+
+  char *stack = ltask_stack_new();
+  LASSERT(a, stack, "Function 'spawn' could not allocate a task stack");
+
+  linterp *in = e->interp;
+  if (!in->sched)
+  {
+    in->sched = calloc(1, sizeof(lsched));
+  }
+  lsched *s = in->sched;
+
+  /* Task calls the function with the remaining arguments in the global environment */
+  ltask *t = calloc(1, sizeof(ltask));
+  t->in = in;
+  t->f = lval_pop(a, 0);
+  t->args = a;
+  t->stack = stack;
+
+  getcontext(&t->ctx);
+  t->ctx.uc_stack.ss_sp = t->stack;
+  t->ctx.uc_stack.ss_size = LTASK_STACK_SIZE;
+  t->ctx.uc_link = &s->ret;
+  uintptr_t p = (uintptr_t)t;
+  makecontext(&t->ctx, (void (*)(void))ltask_entry, 2,
+              (unsigned int)(p >> 16 >> 16), (unsigned int)p);
+
+  s->tasks = realloc(s->tasks, sizeof(ltask *) * (s->count + 1));
+  s->tasks[s->count++] = t;
+
+  return lval_sexpr();
+}
+
+/* Arguments are ignored, a call needs at least one, as in (yield ()) */
+lval *builtin_yield(lenv *e, lval *a)
+{
+  lval_del(a);
+  lsched_yield(e->interp);
+  return lval_sexpr();
+}
+
+lval *builtin_chan(lenv *e, lval *a)
+{
+  LASSERT_COUNT(a, "chan", 1);
+  LASSERT_TYPE(a, "chan", 0, LVAL_NUM);
+
+  int cap = (int)a->cell[0]->num;
+  LASSERT(a, cap >= 1, "Function 'chan' passed capacity %i, Expected at least 1", cap);
+
+  lval_del(a);
+  return lval_chan(e->interp, cap);
+}
+
+lval *builtin_send(lenv *e, lval *a)
+{
+  LASSERT_COUNT(a, "send", 2);
+  LASSERT_TYPE(a, "send", 0, LVAL_CHAN);
+
+  lchan *c = a->cell[0]->chan;
+  LASSERT(a, c->owner == e->interp,
+          "Function 'send' passed a channel of another interpreter");
+  LASSERT(a, lsched_wait(e->interp, c, 1),
+          "Function 'send' would block forever, no task can receive");
+
+  c->buf[(c->head + c->count) % c->cap] = lval_pop(a, 1);
+  c->count++;
+
+  lval_del(a);
+  return lval_sexpr();
+}
+
+lval *builtin_recv(lenv *e, lval *a)
+{
+  LASSERT_COUNT(a, "recv", 1);
+  LASSERT_TYPE(a, "recv", 0, LVAL_CHAN);
+
+  lchan *c = a->cell[0]->chan;
+  LASSERT(a, c->owner == e->interp,
+          "Function 'recv' passed a channel of another interpreter");
+  LASSERT(a, lsched_wait(e->interp, c, 0),
+          "Function 'recv' would block forever, no task can send");
+
+  lval *x = c->buf[c->head];
+  c->head = (c->head + 1) % c->cap;
+  c->count--;
+
+  lval_del(a);
+  return x;
+}
+
+/* Evaluate expression with a fresh profiler and print its report */
+lval *builtin_profile(lenv *e, lval *a)
+{
+  LASSERT_COUNT(a, "profile", 1);
+  LASSERT_TYPE(a, "profile", 0, LVAL_QEXPR);
+
+  linterp *in = e->interp;
+  lprof *outer = in->prof;
+  in->prof = lprof_new();
+
+  lval *x = lval_take(a, 0);
+  x->type = LVAL_SEXPR;
+  x = lval_eval(e, x);
+
+  lprof_report(in->prof, in->out);
+  lprof_del(in->prof);
+  in->prof = outer;
+  return x;
+}
+
+/* Named counters shared by the mem-stats builtin and the exit report */
+int lmem_fields(lmem_stats *m, char **names, double *vals)
+{
+  int n = 0;
+  char *types[LVAL_TYPES] = {"num", "err", "sym", "str", "fun", "sexpr", "qexpr", "chan", "map"};
+  static char keys[LVAL_TYPES][32];
+  for (int i = 0; i < LVAL_TYPES; i++)
+  {
+    snprintf(keys[i], sizeof(keys[i]), "allocs-%s", types[i]);
+    names[n] = keys[i];
+    vals[n++] = m->allocs[i];
+  }
+
+  names[n] = "frees", vals[n++] = m->frees;
+  names[n] = "bytes", vals[n++] = m->bytes;
+  names[n] = "live", vals[n++] = m->live;
+  names[n] = "peak-live", vals[n++] = m->peak;
+  names[n] = "copies", vals[n++] = m->copies;
+  names[n] = "copy-bytes", vals[n++] = m->copy_bytes;
+  names[n] = "lookup-copies", vals[n++] = m->get_copies;
+  names[n] = "env-news", vals[n++] = m->env_news;
+  names[n] = "env-copies", vals[n++] = m->env_copies;
+  names[n] = "env-puts", vals[n++] = m->env_puts;
+  names[n] = "env-live", vals[n++] = m->env_live;
+  names[n] = "env-peak-live", vals[n++] = m->env_peak;
+  return n;
+}
+
+#define LMEM_FIELDS (LVAL_TYPES + 12)
+
+void lmem_report(FILE *out)
+{
+  lmem_stats m = lmem_total();
+  char *names[LMEM_FIELDS];
+  double vals[LMEM_FIELDS];
+  int n = lmem_fields(&m, names, vals);
+  for (int i = 0; i < n; i++)
+  {
+    fprintf(out, "%16s %14.0f\n", names[i], vals[i]);
+  }
+}
+
+/* Memory counters as a list of {name value} pairs, takes a dummy argument like yield */
+lval *builtin_mem_stats(lenv *e, lval *a)
+{
+  lval_del(a);
+
+  /* Snapshot first so building the result is not counted */
+  lmem_stats m = lmem_total();
+  char *names[LMEM_FIELDS];
+  double vals[LMEM_FIELDS];
+  int n = lmem_fields(&m, names, vals);
+
+  lval *x = lval_qexpr();
+  for (int i = 0; i < n; i++)
+  {
+    lval *pair = lval_qexpr();
+    lval_add(pair, lval_sym(names[i]));
+    lval_add(pair, lval_num(vals[i]));
+    lval_add(x, pair);
+  }
+  return x;
+}
+
+/* Builtins are resolved from this constant table instead of being copied into the environment */
+typedef struct
+{
+  char *name;
+  lbuiltin func;
+} lbuiltin_def;
+
+static const lbuiltin_def lbuiltins[] = {
+    /* Variable Functions */
+    {"\\", builtin_lambda},
+    {"def", builtin_def},
+    {"=", builtin_put},
+
+    /* List Functions */
+    {"list", builtin_list},
+    {"head", builtin_head},
+    {"tail", builtin_tail},
+    {"eval", builtin_eval},
+    {"join", builtin_join},
+
+    /* String Functions */
+    {"load", builtin_load},
+    {"error", builtin_error},
+    {"try", builtin_try},
+    {"print", builtin_print},
+
+    /* Mathematical Functions */
+    {"+", builtin_add},
+    {"-", builtin_sub},
+    {"*", builtin_mul},
+    {"/", builtin_div},
+
+    /* Comparison Functions */
+    {"if", builtin_if},
+    {"==", builtin_eq},
+    {"!=", builtin_ne},
+    {">", builtin_gt},
+    {"<", builtin_lt},
+    {">=", builtin_ge},
+    {"<=", builtin_le},
+
+    /* Parallel Functions */
+    {"pmap", builtin_pmap},
+    {"pfold", builtin_pfold},
+
+    /* Concurrency Functions */
+    {"spawn", builtin_spawn},
+    {"yield", builtin_yield},
+    {"chan", builtin_chan},
+    {"send", builtin_send},
+    {"recv", builtin_recv},
+
+    /* Memoization Functions */
+    {"memo", builtin_memo},
+    {"memo-stats", builtin_memo_stats},
+
+    /* Map Functions */
+    {"map-new", builtin_map_new},
+    {"map-get", builtin_map_get},
+    {"map-put", builtin_map_put},
+    {"map-del", builtin_map_del},
+    {"map-keys", builtin_map_keys},
+    {"map-len", builtin_map_len},
+
+    /* Profiling Functions */
+    {"profile", builtin_profile},
+    {"mem-stats", builtin_mem_stats},
+
+    {NULL, NULL}};
+
+/* Builtins that evaluate code while holding memory or state an unwind would skip */
+int lbuiltin_holds(lbuiltin f)
+{
+  return f == builtin_load || f == builtin_pmap || f == builtin_pfold || f == builtin_profile;
+}
+
+/* Index of builtin by name, -1 if there is none */
+int lbuiltin_index(char *name)
+{
+  for (int i = 0; lbuiltins[i].name; i++)
+  {
+    if (strcmp(lbuiltins[i].name, name) == 0)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+lbuiltin lbuiltin_func(int i)
+{
+  return lbuiltins[i].func;
+}
+
+/* Find builtin by name, NULL if there is none */
+lbuiltin lbuiltin_lookup(char *name)
+{
+  int i = lbuiltin_index(name);
+  return i >= 0 ? lbuiltins[i].func : NULL;
+}
+
+void lenv_add_builtins(lenv *e)
+{
+  e->builtins = 1;
+}
+
+
+/* Create interpreter with a fresh global environment */
+linterp *linterp_new(void)
+{
+  linterp *in = calloc(1, sizeof(linterp));
+  in->env = lenv_new();
+  in->env->interp = in;
+  in->env->counted = in;
+  lenv_add_builtins(in->env);
+  in->out = stdout;
+  in->cache = 1;
+  in->cache_dir = ".lispy_cache";
+  return in;
+}
+
+/* Replace the global environment with a copy of another one */
+void linterp_set_env(linterp *in, lenv *e)
+{
+  lenv_del(in->env);
+  in->env = lenv_copy(e);
+  in->env->interp = in;
+  lenv_count(in->env, in);
+}
+
+/* Use e read only below an empty global environment, e must outlive the interpreter */
+void linterp_share_env(linterp *in, lenv *e)
+{
+  in->env->base = e;
+
+  /* Builtins shadowed in the base are counted as if bound here */
+  for (int i = 0; i < e->count; i++)
+  {
+    lfold_shadow(in->env, e->syms[i], 1);
+  }
+}
+
+/* Delete interpreter along with its environment and parsers */
+void linterp_del(linterp *in)
+{
+  if (in->sched)
+  {
+    lsched_del(in->sched);
+  }
+  if (in->prof)
+  {
+    lprof_del(in->prof);
+  }
+  if (in->sampler)
+  {
+    lsampler_del(in->sampler);
+  }
+  lenv_del(in->env);
+
+  /* Undefine and Delete our Parsers if they were ever built */
+  if (in->Lispy)
+  {
+    mpc_cleanup(8, in->Number, in->Symbol, in->String, in->Comment,
+                in->Sexpr, in->Qexpr, in->Expr, in->Lispy);
+  }
+  free(in);
+}
+
+/* Load file into the interpreter's global environment, printing any error */
+void linterp_load(linterp *in, char *filename)
+{
+  /* Argument list with a single argument, the filename */
+  lval *args = lval_add(lval_sexpr(), lval_str(filename));
+
+  /* Pass to builtin load and get the result */
+  lval *x = builtin_load(in->env, args);
+
+  /* If the result is an error be sure to print it */
+  if (x->type == LVAL_ERR)
+  {
+    lval_println(in->out, x);
+  }
+
+  lval_del(x);
+
+  /* Let tasks spawned by the file run to completion */
+  lsched_drain(in);
+}
+
+/* Parse and evaluate input starting on the given zero based line, printing the result */
+/* Input that ends inside an expression reports its error where the expression starts */
+void linterp_eval_at(linterp *in, char *input, long row, int unterminated)
+{
+  /* Attempt to Parse the user Input */
+  mpc_result_t r;
+  if (mpc_parse("<stdin>", input, lispy_parser(in), &r))
+  {
+    lval *x = lval_eval(in->env, lval_read(r.output));
+    lval_println(in->out, x);
+    lval_del(x);
+    lsched_drain(in);
+
+    mpc_ast_delete(r.output);
+  }
+  else
+  {
+    /* Print the Error at its place in the whole input */
+    if (unterminated)
+    {
+      r.error->state.row = 0;
+      r.error->state.col = (long)strspn(input, " \t\r");
+    }
+    r.error->state.row += row;
+    mpc_err_print_to(r.error, in->out);
+    mpc_err_delete(r.error);
+  }
+}
+
+/* Parse and evaluate one line of input, printing the result */
+void linterp_eval_line(linterp *in, char *input)
+{
+  linterp_eval_at(in, input, 0, 0);
+}
+
+/* Evaluate non-interactive input read in large blocks */
+/* Like the prompt each line is one expression, unless brackets or a string continue it */
+void linterp_batch(linterp *in, FILE *f)
+{
+  size_t cap = 1 << 16;
+  size_t len = 0;
+  size_t start = 0;
+  size_t pos = 0;
+  char *buf = malloc(cap + 1);
+
+  /* Scanner state of the expression being collected */
+  int depth = 0;
+  int in_str = 0;
+  int escaped = 0;
+  int in_comment = 0;
+
+  /* Lines read so far and the line the expression being collected starts on */
+  long row = 0;
+  long start_row = 0;
+
+  while (1)
+  {
+    size_t n = fread(buf + len, 1, cap - len, f);
+    len += n;
+
+    for (; pos < len; pos++)
+    {
+      char c = buf[pos];
+      if (in_comment)
+      {
+        in_comment = c != '\n';
+      }
+      else if (in_str)
+      {
+        in_str = escaped || c != '"';
+        escaped = !escaped && c == '\\';
+      }
+      else if (c == ';')
+      {
+        in_comment = 1;
+      }
+      else if (c == '"')
+      {
+        in_str = 1;
+      }
+      else if (c == '(' || c == '{')
+      {
+        depth++;
+      }
+      else if (c == ')' || c == '}')
+      {
+        depth--;
+      }
+
+      if (c == '\n')
+      {
+        row++;
+      }
+
+      /* A newline outside of any bracket or string ends the expression */
+      if (c == '\n' && !in_str && depth <= 0)
+      {
+        buf[pos] = '\0';
+        if (strspn(buf + start, " \t\r") != pos - start)
+        {
+          linterp_eval_at(in, buf + start, start_row, 0);
+        }
+        start = pos + 1;
+        start_row = row;
+        depth = 0;
+      }
+    }
+
+    if (n == 0)
+    {
+      break;
+    }
+
+    /* Move the unfinished expression to the front, growing if it fills the buffer */
+    memmove(buf, buf + start, len - start);
+    len -= start;
+    pos -= start;
+    start = 0;
+    if (len == cap)
+    {
+      cap *= 2;
+      buf = realloc(buf, cap + 1);
+    }
   }
-  if (strcmp("mod", func) == 0)
+
+  /* Final line without a newline, or an expression never closed */
+  buf[len] = '\0';
+  if (strspn(buf + start, " \t\r\n") != len - start)
   {
-    return builtin_op(e, a, func);
+    linterp_eval_at(in, buf + start, start_row, depth > 0 || in_str);
   }
-  if (strcmp("pow", func) == 0)
+
+  free(buf);
+}
+
+/* Evaluation server on a Unix domain socket */
+/* Requests and responses are framed by a 4 byte big endian length */
+
+#define LSERVE_MAX_FRAME (16 << 20)
+
+typedef struct
+{
+  int fd;
+
+  /* Bytes received but not yet evaluated */
+  lbuf rbuf;
+
+  /* Responses not yet written, starting at wpos */
+  lbuf wbuf;
+  size_t wpos;
+
+  /* Peer has finished sending, the connection closes once its responses are written */
+  int eof;
+
+  /* Child of the global environment so '=' stays private to the connection */
+  lenv *env;
+} lconn;
+
+volatile sig_atomic_t lserve_stop = 0;
+
+void lserve_signal(int sig)
+{
+  lserve_stop = 1;
+}
+
+void lconn_del(lconn *c)
+{
+  close(c->fd);
+  lenv_del(c->env);
+  free(c->rbuf.data);
+  free(c->wbuf.data);
+  free(c);
+}
+
+/* Evaluate one request, everything printed becomes part of the response */
+void lconn_eval(linterp *in, lconn *c, char *expr)
+{
+  char *text = NULL;
+  size_t len = 0;
+  FILE *out = in->out;
+  in->out = open_memstream(&text, &len);
+
+  mpc_result_t r;
+  if (mpc_parse("<request>", expr, lispy_parser(in), &r))
   {
-    return builtin_op(e, a, func);
+    lval *x = lval_eval(c->env, lval_read(r.output));
+    lval_print(in->out, x);
+    lval_del(x);
+    lsched_drain(in);
+    mpc_ast_delete(r.output);
   }
-  if (strcmp("min", func) == 0)
+  else
   {
-    return builtin_op(e, a, func);
+    mpc_err_print_to(r.error, in->out);
+    mpc_err_delete(r.error);
   }
-  if (strcmp("max", func) == 0)
+
+  fclose(in->out);
+  in->out = out;
+
+  unsigned char hdr[4] = {len >> 24, len >> 16, len >> 8, len};
+  lbuf_put(&c->wbuf, hdr, 4);
+  lbuf_put(&c->wbuf, text, len);
+  free(text);
+}
+
+/* Write as much pending output as the socket takes, 0 on error */
+int lconn_flush(lconn *c)
+{
+  while (c->wpos < c->wbuf.len)
   {
-    return builtin_op(e, a, func);
+    ssize_t n = write(c->fd, c->wbuf.data + c->wpos, c->wbuf.len - c->wpos);
+    if (n < 0)
+    {
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    c->wpos += n;
   }
-  lval_del(a);
-  return lval_err("Unkown Function!");
+  c->wbuf.len = 0;
+  c->wpos = 0;
+  return 1;
 }
 
-lval *lval_eval_sexpr(lenv *e, lval *v)
+/* Read everything available and evaluate each complete frame, 0 on error */
+int lconn_read(linterp *in, lconn *c)
 {
-  /* Evaluate Children */
-  for (int i = 0; i < v->count; i++)
+  char chunk[1 << 16];
+  int open = 1;
+  while (!c->eof)
   {
-    v->cell[i] = lval_eval(e, v->cell[i]);
+    ssize_t n = read(c->fd, chunk, sizeof(chunk));
+    if (n > 0)
+    {
+      lbuf_put(&c->rbuf, chunk, n);
+      continue;
+    }
+    if (n == 0)
+    {
+      c->eof = 1;
+    }
+    else if (errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+      open = 0;
+    }
+    break;
   }
 
-  /* Error Checking */
-  for (int i = 0; i < v->count; i++)
+  /* Pipelined requests are answered in order */
+  size_t pos = 0;
+  while (c->rbuf.len - pos >= 4)
   {
-    if (v->cell[i]->type == LVAL_ERR)
+    unsigned char *h = (unsigned char *)c->rbuf.data + pos;
+    size_t len = (size_t)h[0] << 24 | h[1] << 16 | h[2] << 8 | h[3];
+    if (len > LSERVE_MAX_FRAME)
     {
-      return lval_take(v, i);
+      return 0;
     }
+    if (c->rbuf.len - pos - 4 < len)
+    {
+      break;
+    }
+
+    char *expr = malloc(len + 1);
+    memcpy(expr, c->rbuf.data + pos + 4, len);
+    expr[len] = '\0';
+    lconn_eval(in, c, expr);
+    free(expr);
+    pos += 4 + len;
   }
+  memmove(c->rbuf.data, c->rbuf.data + pos, c->rbuf.len - pos);
+  c->rbuf.len -= pos;
 
-  /* Empty Expression */
-  if (v->count == 0)
+  return lconn_flush(c) && open;
+}
+
+/* Serve requests until interrupted, returns non zero on setup failure */
+int linterp_serve(linterp *in, char *path)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path))
   {
-    return v;
+    fprintf(stderr, "Error: socket path too long '%s'\n", path);
+    return 1;
   }
+  strcpy(addr.sun_path, path);
 
-  /* Single Expression*/
-  if (v->count == 1)
+  /* A socket left by an earlier server is replaced, anything else at the path is kept */
+  struct stat st;
+  if (lstat(path, &st) == 0)
   {
-    return lval_take(v, 0);
+    if (!S_ISSOCK(st.st_mode))
+    {
+      fprintf(stderr, "Error: '%s' exists and is not a socket\n", path);
+      return 1;
+    }
+    unlink(path);
   }
 
-  /* Ensure First Element is a function after evaluation */
-  lval *f = lval_pop(v, 0);
-  if (f->type != LVAL_FUN)
+  int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, SOMAXCONN) < 0)
   {
-    lval *err = lval_err("S-Expression starts with incorrect type. Got %s, Expected %s.",
-                         ltype_name(f->type), ltype_name(LVAL_FUN));
-    lval_del(f);
-    lval_del(v);
-    return err;
+    perror("Error: cannot listen");
+    return 1;
   }
 
-  /* If so call function to get result */
-  lval *result = lval_call(e, f, v);
-  lval_del(f);
-  return result;
-}
+  int ep = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl(ep, EPOLL_CTL_ADD, lfd, &ev);
 
-lval *lval_eval(lenv *e, lval *v)
-{
-  if (v->type == LVAL_SYM)
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = lserve_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  /* Grammar is built once up front instead of on the first request */
+  lispy_parser(in);
+
+  /* Connections are tracked so they can be closed on shutdown */
+  lconn **conns = NULL;
+  int nconns = 0;
+
+  struct epoll_event events[64];
+  while (!lserve_stop)
   {
-    lval *x = lenv_get(e, v);
-    lval_del(v);
-    return x;
+    int n = epoll_wait(ep, events, 64, -1);
+    for (int i = 0; i < n; i++)
+    {
+      lconn *c = events[i].data.ptr;
+
+      /* New connections */
+      if (!c)
+      {
+        int fd;
+        while ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+        {
+          c = calloc(1, sizeof(lconn));
+          c->fd = fd;
+          c->env = lenv_new();
+          c->env->par = in->env;
+          c->env->interp = in;
+          c->env->counted = in;
+          ev.events = EPOLLIN;
+          ev.data.ptr = c;
+          epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+          conns = realloc(conns, sizeof(lconn *) * (nconns + 1));
+          conns[nconns++] = c;
+        }
+        continue;
+      }
+
+      int ok = 1;
+      if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+      {
+        ok = lconn_read(in, c);
+      }
+      else if (events[i].events & EPOLLOUT)
+      {
+        ok = lconn_flush(c);
+      }
+
+      /* A half closed peer still gets every response before the close */
+      if (!ok || (c->eof && !c->wbuf.len))
+      {
+        for (int j = 0; j < nconns; j++)
+        {
+          if (conns[j] == c)
+          {
+            conns[j] = conns[--nconns];
+            break;
+          }
+        }
+        epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);
+        lconn_del(c);
+        continue;
+      }
+
+      /* Only wait for writability while responses are pending, and for input until the peer is done */
+      ev.events = (c->eof ? 0 : EPOLLIN) | (c->wbuf.len ? EPOLLOUT : 0);
+      ev.data.ptr = c;
+      epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev);
+    }
   }
 
-  if (v->type == LVAL_SEXPR)
+  for (int i = 0; i < nconns; i++)
   {
-    return lval_eval_sexpr(e, v);
+    lconn_del(conns[i]);
   }
-
-  return v;
+  free(conns);
+  close(ep);
+  close(lfd);
+  unlink(path);
+  return 0;
 }
 
-lval *lval_builtin(lbuiltin func)
-{
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_FUN;
-  v->builtin = func;
-  return v;
-}
+/* Parallel evaluation of independent files */
 
-/* Register builtins into environment */
-void lenv_add_builtin(lenv *e, char *name, lbuiltin func)
+typedef struct
 {
-  lval *k = lval_sym(name);
-  lval *v = lval_builtin(func);
-  lenv_put(e, k, v);
-  lval_del(k);
-  lval_del(v);
-}
+  char **files;
+  int count;
+  int next;
+  pthread_mutex_t lock;
 
-lval *builtin_var(lenv *e, lval *a, char *func)
-{
-  LASSERT_TYPE(a, func, 0, LVAL_QEXPR);
+  /* Interpreter whose environment and settings every job starts from */
+  linterp *base;
 
-  /* First argument is symbol list */
-  lval *syms = a->cell[0];
+  /* Captured output of each file */
+  char **output;
+  size_t *output_len;
+} ljobs;
 
-  /* Ensure all elements of first list are symbols */
-  for (int i = 0; i < syms->count; i++)
+/* Each worker owns an interpreter and resets its environment per file */
+void *ljobs_worker(void *arg)
+{
+  ljobs *j = arg;
+  linterp *in = linterp_new();
+  in->cache = j->base->cache;
+  in->cache_dir = j->base->cache_dir;
+
+  while (1)
   {
-    LASSERT(a, syms->cell[i]->type == LVAL_SYM,
-            "Function '%s' cannot define non-symbol. Got %s, Expected %s",
-            func, ltype_name(syms->cell[i]->type), ltype_name(LVAL_SYM));
-  }
+    /* Take the next file that nobody has started yet */
+    pthread_mutex_lock(&j->lock);
+    int i = j->next++;
+    pthread_mutex_unlock(&j->lock);
 
-  /* Check correct number of symbols and values */
-  LASSERT(a, (syms->count == a->count - 1),
-          "Function '%s' passed too many arguments for symbols. Got %i, Expected %i",
-          func, syms->count, a->count - 1);
+    if (i >= j->count)
+    {
+      break;
+    }
 
-  /* Assign copies of values to symbols */
-  for (int i = 0; i < syms->count; i++)
-  {
-    /* If 'def' define in globally. If 'put' define in locally. */
-    if (strcmp(func, "def") == 0)
-      lenv_def(e, syms->cell[i], a->cell[i + 1]);
-    if (strcmp(func, "=") == 0)
-      lenv_put(e, syms->cell[i], a->cell[i + 1]);
+    linterp_set_env(in, j->base->env);
+    in->out = open_memstream(&j->output[i], &j->output_len[i]);
+    linterp_load(in, j->files[i]);
+    fclose(in->out);
   }
 
-  lval_del(a);
-  return lval_sexpr();
+  in->out = stdout;
+  linterp_del(in);
+  lmem_merge();
+  lunwind_free();
+  return NULL;
 }
 
-/* Define variable */
-lval *builtin_def(lenv *e, lval *a)
+/* Run each file on a pool of worker threads and print outputs in order */
+void ljobs_run(linterp *base, char **files, int count, int nthreads)
 {
-  return builtin_var(e, a, "def");
-}
+  ljobs j;
+  j.files = files;
+  j.count = count;
+  j.next = 0;
+  j.base = base;
+  j.output = calloc(count, sizeof(char *));
+  j.output_len = calloc(count, sizeof(size_t));
+  pthread_mutex_init(&j.lock, NULL);
+
+  if (nthreads > count)
+  {
+    nthreads = count;
+  }
+  pthread_t *threads = malloc(sizeof(pthread_t) * nthreads);
+  for (int i = 0; i < nthreads; i++)
+  {
+    pthread_create(&threads[i], NULL, ljobs_worker, &j);
+  }
+  for (int i = 0; i < nthreads; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
 
-lval *builtin_put(lenv *e, lval *a)
-{
-  return builtin_var(e, a, "=");
-}
+  for (int i = 0; i < count; i++)
+  {
+    fwrite(j.output[i], 1, j.output_len[i], base->out);
+    free(j.output[i]);
+  }
 
-void lenv_add_builtins(lenv *e)
-{
-  /* Variable Functions */
-  lenv_add_builtin(e, "\\", builtin_lambda);
-  lenv_add_builtin(e, "def", builtin_def);
-  lenv_add_builtin(e, "=", builtin_put);
-
-  /* List Functions */
-  lenv_add_builtin(e, "list", builtin_list);
-  lenv_add_builtin(e, "head", builtin_head);
-  lenv_add_builtin(e, "tail", builtin_tail);
-  lenv_add_builtin(e, "eval", builtin_eval);
-  lenv_add_builtin(e, "join", builtin_join);
-
-  /* String Functions */
-  lenv_add_builtin(e, "load", builtin_load);
-  lenv_add_builtin(e, "error", builtin_error);
-  lenv_add_builtin(e, "print", builtin_print);
-
-  /* Mathematical Functions */
-  lenv_add_builtin(e, "+", builtin_add);
-  lenv_add_builtin(e, "-", builtin_sub);
-  lenv_add_builtin(e, "*", builtin_mul);
-  lenv_add_builtin(e, "/", builtin_div);
-
-  /* Comparison Functions */
-  lenv_add_builtin(e, "if", builtin_if);
-  lenv_add_builtin(e, "==", builtin_eq);
-  lenv_add_builtin(e, "!=", builtin_ne);
-  lenv_add_builtin(e, ">", builtin_gt);
-  lenv_add_builtin(e, "<", builtin_lt);
-  lenv_add_builtin(e, ">=", builtin_ge);
-  lenv_add_builtin(e, "<=", builtin_le);
+  pthread_mutex_destroy(&j.lock);
+  free(threads);
+  free(j.output);
+  free(j.output_len);
 }
 
+/* Benchmarks include this file for the interpreter without its entry point */
+#ifndef LISPY_NO_MAIN
 int main(int argc, char **argv)
 {
-  /* Create Parsers */
-  Number = mpc_new("number");
-  Symbol = mpc_new("symbol");
-  String = mpc_new("string");
-  Comment = mpc_new("comment");
-  Sexpr = mpc_new("sexpr");
-  Qexpr = mpc_new("qexpr");
-  Expr = mpc_new("expr");
-  Lispy = mpc_new("lispy");
-
-  /* Define them with the following Language */
-  mpca_lang(MPCA_LANG_DEFAULT,
-            "                                                         \
-      number : /-?[0-9]+[.]*[0-9]*/ ;                                 \
-      symbol : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;                     \
-      string : /\"(\\\\.|[^\"])*\"/ ;                                 \
-      comment: /;[^\\r\\n]*/ ;                                        \
-      sexpr  : '(' <expr>* ')' ;                                      \
-      qexpr  : '{' <expr>* '}' ;                                      \
-      expr   : <number> | <symbol> | <string>                         \
-             | <comment> | <sexpr> | <qexpr> ;                        \
-      lispy  : /^/ <expr>* /$/ ;                                      \
-      ",
-            Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+  linterp *in = linterp_new();
+  int mem_stats = 0;
+  int status = 0;
 
-  lenv *e = lenv_new();
-  lenv_add_builtins(e);
+  /* Piped input is evaluated in batch with a large output buffer */
+  if (argc == 1 && !isatty(STDIN_FILENO))
+  {
+    setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+    linterp_batch(in, stdin);
+    fflush(stdout);
+  }
 
   /* Interactive Prompt */
-  if (argc == 1)
+  else if (argc == 1)
   {
     puts("Lispy version 0.0.0.0.8");
     puts("Press Ctrl+c to Exit\n");
@@ -1478,24 +5388,15 @@ int main(int argc, char **argv)
     while (1)
     {
       char *input = readline("lispy :> ");
-      add_history(input);
-
-      /* Attempt to Parse the user Input */
-      mpc_result_t r;
-      if (mpc_parse("<stdin>", input, Lispy, &r))
-      {
-        lval *x = lval_eval(e, lval_read(r.output));
-        lval_println(x);
-        lval_del(x);
 
-        mpc_ast_delete(r.output);
-      }
-      else
+      /* End of input */
+      if (!input)
       {
-        /* Print the Error */
-        mpc_err_print(r.error);
-        mpc_err_delete(r.error);
+        break;
       }
+      add_history(input);
+
+      linterp_eval_line(in, input);
 
       free(input);
     }
@@ -1504,29 +5405,135 @@ int main(int argc, char **argv)
   /* Supplied with list of files */
   if (argc >= 2)
   {
-    /* loop over each supplied filename (starting from 1) */
+    /* Flags are all read before anything runs, so they apply wherever they appear */
+    int jobs = 0;
+    int profile = 0;
+    int sample = 0;
+    int clear_cache = 0;
+    char *serve = NULL;
+    char **preludes = malloc(sizeof(char *) * argc);
+    int prelude_count = 0;
+    char **files = malloc(sizeof(char *) * argc);
+    int file_count = 0;
+
+    /* loop over each supplied argument (starting from 1) */
     for (int i = 1; i < argc; i++)
     {
-      /* Argument list with a single argument, the filename */
-      lval *args = lval_add(lval_sexpr(), lval_str(argv[i]));
+      /* Files are evaluated in isolation on this many threads */
+      if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+      {
+        jobs = atoi(argv[++i]);
+        continue;
+      }
+
+      /* Dump allocation counters when the program exits */
+      if (strcmp(argv[i], "--mem-stats") == 0)
+      {
+        mem_stats = 1;
+        continue;
+      }
+
+      /* Profile everything, reported when the program exits */
+      if (strcmp(argv[i], "--profile") == 0)
+      {
+        profile = 1;
+        continue;
+      }
+
+      /* Sample the call stack, written as folded stacks when the program exits */
+      if (strcmp(argv[i], "--sample") == 0)
+      {
+        sample = 1;
+        continue;
+      }
+
+      /* Serve requests once the preludes and files are loaded, reports follow shutdown */
+      if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+      {
+        serve = argv[++i];
+        continue;
+      }
+
+      /* Preludes are loaded into the environment every job copies */
+      if (strcmp(argv[i], "--prelude") == 0 && i + 1 < argc)
+      {
+        preludes[prelude_count++] = argv[++i];
+        continue;
+      }
+
+      /* Cache options apply to every file */
+      if (strcmp(argv[i], "--no-cache") == 0)
+      {
+        in->cache = 0;
+        continue;
+      }
+      if (strcmp(argv[i], "--clear-cache") == 0)
+      {
+        clear_cache = 1;
+        continue;
+      }
+
+      files[file_count++] = argv[i];
+    }
+
+    if (clear_cache)
+    {
+      lcache_clear(in->cache_dir);
+    }
+    if (profile)
+    {
+      in->prof = lprof_new();
+    }
+    if (sample)
+    {
+      in->sampler = lsampler_start(997);
+    }
 
-      /* Pass to builtin load and get the result */
-      lval *x = builtin_load(e, args);
+    for (int i = 0; i < prelude_count; i++)
+    {
+      linterp_load(in, preludes[i]);
+    }
 
-      /* If the result is an error be sure to print it */
-      if (x->type == LVAL_ERR)
+    if (jobs > 0 && !serve && file_count > 0)
+    {
+      ljobs_run(in, files, file_count, jobs);
+    }
+    else
+    {
+      for (int i = 0; i < file_count; i++)
       {
-        lval_println(x);
+        linterp_load(in, files[i]);
       }
+    }
 
-      lval_del(x);
+    if (serve)
+    {
+      status = linterp_serve(in, serve);
     }
+
+    free(preludes);
+    free(files);
   }
 
-  lenv_del(e);
+  if (in->prof)
+  {
+    lprof_report(in->prof, stderr);
+    lprof_write(in->prof, "lispy.prof");
+  }
+  if (in->sampler)
+  {
+    lsampler_stop(in->sampler);
+    lsampler_write(in->sampler, "lispy.folded");
+  }
+  linterp_del(in);
+  lunwind_free();
 
-  /* Undefine and Delete our Parsers */
-  mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+  /* Reported after teardown so anything still live has leaked */
+  if (mem_stats)
+  {
+    lmem_report(stderr);
+  }
 
-  return 0;
+  return status;
 }
+#endif